@@ -0,0 +1,147 @@
+#include "ZippedAfx.h"
+
+// Completion key of the requests which are read by the worker
+static const ULONG_PTR ReadByWorker = 1;
+
+struct ZippedReadRequest {
+  OVERLAPPED Overlapped; // The port returns the address of this member
+  ZippedAsyncFile* File;
+  byte* Buffer;     // Aligned buffer of the unbuffered read or the Data
+  ulong BufferLength;
+  ulong Head;       // Bytes before the Data in the aligned buffer
+  byte* Data;
+  ulong Length;
+  ZippedReadProc Procedure;
+  void* Context;
+};
+
+
+
+ZippedAsyncIO::ZippedAsyncIO( const uint& threadsCount ) {
+  Port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, Null, 0, 0 );
+  ZIPASSERT( Port != Null, "Can not create a zipped I/O completion port." );
+
+  ThreadsCount = threadsCount;
+  Threads = new Common::Thread[ThreadsCount];
+  for( uint i = 0; i < ThreadsCount; i++ ) {
+    Threads[i].Init( &WorkerThread );
+    Threads[i].Detach( this );
+  }
+}
+
+ulong WINAPI ZippedAsyncIO::WorkerThread( void* argument ) {
+  ZippedAsyncIO* asyncIO = (ZippedAsyncIO*)argument;
+  while( true ) {
+    DWORD readed = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED* overlapped = Null;
+    BOOL success = GetQueuedCompletionStatus( asyncIO->Port, &readed, &key, &overlapped, INFINITE );
+    if( overlapped == Null )
+      break;
+
+    auto request = (ZippedReadRequest*)overlapped;
+    if( key == ReadByWorker )
+      success = ReadFile( request->File->Handle, request->Buffer, request->BufferLength, &readed, &request->Overlapped );
+
+    // A failed read is passed as a short one
+    if( !success )
+      readed = 0;
+
+    if( request->Buffer != request->Data ) {
+      // Trims the sector rounding of the unbuffered read
+      readed = readed > request->Head ? min( (ulong)readed - request->Head, request->Length ) : 0;
+      memcpy( request->Data, request->Buffer + request->Head, readed );
+      _aligned_free( request->Buffer );
+    }
+
+    request->Procedure( request->Context, request->Data, readed );
+    delete request;
+  }
+
+  return 0;
+}
+
+ZippedAsyncFile* ZippedAsyncIO::Open( FILE* file, const bool& direct ) {
+  HANDLE handle = (HANDLE)_get_osfhandle( _fileno( file ) );
+  if( handle == INVALID_HANDLE_VALUE )
+    return Null;
+
+  // The private handle has its own file pointer,
+  // so the workers never move the pointer of the FILE
+  const ulong share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+  const ulong flags = direct ? FILE_FLAG_NO_BUFFERING : 0;
+  HANDLE reopened = ReOpenFile( handle, GENERIC_READ, share, flags | FILE_FLAG_OVERLAPPED );
+  bool overlapped = reopened != INVALID_HANDLE_VALUE;
+  if( overlapped && CreateIoCompletionPort( reopened, Port, 0, 0 ) != Port ) {
+    CloseHandle( reopened );
+    overlapped = false;
+  }
+
+  if( !overlapped ) {
+    reopened = ReOpenFile( handle, GENERIC_READ, share, flags );
+    if( reopened == INVALID_HANDLE_VALUE )
+      return Null;
+  }
+
+  ZippedAsyncFile* asyncFile = new ZippedAsyncFile();
+  asyncFile->Handle     = reopened;
+  asyncFile->Overlapped = overlapped;
+  asyncFile->Alignment  = direct ? ZippedDirectAlignment : 0;
+  return asyncFile;
+}
+
+void ZippedAsyncIO::Close( ZippedAsyncFile* file ) {
+  CloseHandle( file->Handle );
+  delete file;
+}
+
+void ZippedAsyncIO::Read( ZippedAsyncFile* file, const ULONGLONG& offset, byte* data, const ulong& length, ZippedReadProc procedure, void* context ) {
+  ZippedReadRequest* request = new ZippedReadRequest();
+  request->File         = file;
+  request->Buffer       = data;
+  request->BufferLength = length;
+  request->Head         = 0;
+  request->Data         = data;
+  request->Length       = length;
+  request->Procedure    = procedure;
+  request->Context      = context;
+
+  ULONGLONG readOffset = offset;
+  if( file->Alignment > 0 ) {
+    // The read covers the whole sectors around the data
+    ulong alignment = file->Alignment;
+    readOffset = offset / alignment * alignment;
+    request->Head = (ulong)(offset - readOffset);
+    request->BufferLength = (request->Head + length + alignment - 1) / alignment * alignment;
+    request->Buffer = (byte*)_aligned_malloc( request->BufferLength, alignment );
+    ZIPASSERT( request->Buffer != Null, "Can not alloc buffer. Out of memory." );
+  }
+
+  memset( &request->Overlapped, 0, sizeof( request->Overlapped ) );
+  request->Overlapped.Offset     = (DWORD)readOffset;
+  request->Overlapped.OffsetHigh = (DWORD)(readOffset >> 32);
+
+  if( file->Overlapped ) {
+    // The port gets the completion of both pending and finished reads
+    if( ReadFile( file->Handle, request->Buffer, request->BufferLength, Null, &request->Overlapped ) || GetLastError() == ERROR_IO_PENDING )
+      return;
+
+    PostQueuedCompletionStatus( Port, 0, 0, &request->Overlapped );
+    return;
+  }
+
+  PostQueuedCompletionStatus( Port, 0, ReadByWorker, &request->Overlapped );
+}
+
+ZippedAsyncIO::~ZippedAsyncIO() {
+  for( uint i = 0; i < ThreadsCount; i++ )
+    Threads[i].Break();
+
+  CloseHandle( Port );
+  delete[] Threads;
+}
+
+ZippedAsyncIO& ZippedAsyncIO::GetInstance() {
+  static ZippedAsyncIO asyncIO( max( 1ul, ZIPPED_THREADS_COUNT ) );
+  return asyncIO;
+}
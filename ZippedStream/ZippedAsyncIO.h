@@ -0,0 +1,38 @@
+#pragma once
+
+
+
+typedef void( *ZippedReadProc )( void* context, byte* data, const ulong& length );
+
+// Offsets, lengths and buffers of the unbuffered reads are aligned
+// to the page, it is a multiple of the disk sector sizes
+const ulong ZippedDirectAlignment = 4096;
+
+// Private read handle of a stream file. Overlapped handles are
+// bound to the completion port, others are read by the workers
+// with the positional ReadFile.
+struct ZippedAsyncFile {
+  HANDLE Handle;
+  bool Overlapped;
+  ulong Alignment; // Not zero for the handles without the system cache
+};
+
+// Positional reads of the compressed blocks on the I/O workers.
+// A read is issued as an overlapped request, so several reads stay
+// in flight while the workers inflate the completed ones. The
+// procedure of the read is called on the worker which got it.
+class ZSTREAMAPI ZippedAsyncIO {
+  HANDLE Port;
+  Common::Thread* Threads;
+  uint ThreadsCount;
+
+  ZippedAsyncIO( const uint& threadsCount );
+  static ulong WINAPI WorkerThread( void* argument );
+
+public:
+  ZippedAsyncFile* Open( FILE* file, const bool& direct = false );
+  void Close( ZippedAsyncFile* file );
+  void Read( ZippedAsyncFile* file, const ULONGLONG& offset, byte* data, const ulong& length, ZippedReadProc procedure, void* context );
+  ~ZippedAsyncIO();
+  static ZippedAsyncIO& GetInstance();
+};
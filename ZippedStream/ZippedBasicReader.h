@@ -0,0 +1,355 @@
+#pragma once
+
+
+
+// Inflate codec of the basic reader. A codec is a struct with the
+// static Decompress function, so the call is resolved at compile time.
+struct ZippedDeflateCodec {
+  static __forceinline bool Decompress( byte* destination, ulong& length, const byte* source, const ulong& sourceLength, const byte* dictionary, const ulong& dictionaryLength ) {
+    if( !dictionary ) {
+      uLongf destinationLength = length;
+      int result = uncompress( destination, &destinationLength, source, sourceLength );
+      length = destinationLength;
+      return result == Z_OK;
+    }
+
+    z_stream stream;
+    memset( &stream, 0, sizeof( stream ) );
+    if( inflateInit( &stream ) != Z_OK )
+      return false;
+
+    stream.next_in   = (Bytef*)source;
+    stream.avail_in  = sourceLength;
+    stream.next_out  = destination;
+    stream.avail_out = length;
+    int result = inflate( &stream, Z_FINISH );
+    if( result == Z_NEED_DICT ) {
+      result = inflateSetDictionary( &stream, dictionary, dictionaryLength );
+      if( result == Z_OK )
+        result = inflate( &stream, Z_FINISH );
+    }
+
+    length = stream.total_out;
+    inflateEnd( &stream );
+    return result == Z_STREAM_END;
+  }
+};
+
+
+
+// Reader of the streams with a block size known at compile time.
+// It has no virtual calls, the block lookup is a shift and a mask
+// and the codec is inlined. The blocks are decompressed on the
+// calling thread into one buffer, so the reader suits the
+// sequential scans. Chunked streams are not supported.
+template <class Codec, uint BlockShift>
+class BasicZippedReader {
+public:
+  static const ulong BlockSize = 1ul << BlockShift;
+  static const ulong BlockMask = BlockSize - 1;
+
+protected:
+  struct BlockEntry {
+    ulong FilePosition; // Start of the block header in the base stream
+    ulong LengthCompressed;
+    ulong LengthSource;
+    ulong Flags;
+    ulong Reference;
+    ulong Filter;
+    ulong ChecksumSource;
+    bool Loaded;        // The block extension is read
+  };
+
+  struct {
+    ulong Length;
+    ulong BlockSize;
+    uint BlocksCount;
+  }
+  Header;
+  ZippedStreamExtension Extension;
+  FILE* BaseStream;
+  ZippedMemory* Memory;
+  long BasePosition;
+  byte* Dictionary;
+  BlockEntry* Blocks;
+  uint DiscoveredCount;    // Blocks with the known positions
+  ulong DiscoveryPosition; // End of the last discovered block, relative
+  ulong Position;
+  uint CurrentBlock;  // Block in the Source buffer, Invalid when none
+  ulong CurrentLength;
+  byte* Source;
+  byte* Compressed;
+  byte* Filtered;
+  bool Verification;
+
+  void CommitHeader() {
+    ZippedMemory::ReadAt( BaseStream, Memory, &Header, BasePosition, sizeof( Header ) );
+    memset( &Extension, 0, sizeof( Extension ) );
+    ulong headerSize = sizeof( Header );
+    if( Header.BlockSize & ZippedHeaderExtended ) {
+      Header.BlockSize &= ~ZippedHeaderExtended;
+      ulong position = BasePosition + sizeof( Header );
+      ZippedMemory::ReadAt( BaseStream, Memory, &Extension, position, sizeof( ulong ) * 2 );
+      ZIPASSERT( Extension.Signature == ZippedExtensionSignature, "Bad zipped stream extension signature." );
+      ZIPASSERT( Extension.Size >= sizeof( ulong ) * 2, "Bad zipped stream extension size." );
+      ulong extensionSize = min( Extension.Size, sizeof( Extension ) ) - sizeof( ulong ) * 2;
+      ZippedMemory::ReadAt( BaseStream, Memory, &Extension.Flags, position + sizeof( ulong ) * 2, extensionSize );
+      ZIPASSERT( !(Extension.Flags & ZIPPED_STREAM_ALIGNED) || Extension.BlockAlignment > 0, "Bad zipped stream block alignment." );
+
+      if( Extension.DictionaryLength > 0 ) {
+        Dictionary = new byte[Extension.DictionaryLength];
+        ZippedMemory::ReadAt( BaseStream, Memory, Dictionary, position + Extension.Size, Extension.DictionaryLength );
+      }
+
+      headerSize += Extension.Size + Extension.DictionaryLength;
+    }
+
+    ZIPASSERT( Header.BlockSize == BlockSize, "Zipped stream block size does not match the reader." );
+    ZIPASSERT( !(Extension.Flags & ZIPPED_STREAM_CHUNKED), "Chunked zipped streams are not supported by the basic reader." );
+    CommitData( headerSize );
+  }
+
+  void ReadTrailer( ZippedStreamTrailer& trailer ) {
+    ULONGLONG size = 0;
+    ULONGLONG time = 0;
+    if( Memory )
+      size = Memory->GetLength();
+    else
+      ZIPASSERT( ZippedIndex::GetFileStamp( BaseStream, size, time ), "Can not get the zipped stream size." );
+
+    memset( &trailer, 0, sizeof( trailer ) );
+    if( size >= sizeof( trailer ) )
+      ZippedMemory::ReadAt( BaseStream, Memory, &trailer, (ulong)size - sizeof( trailer ), sizeof( trailer ) );
+
+    ZIPASSERT( trailer.Signature == ZippedTrailerSignature, "Zipped stream trailer is missing." );
+    Header.Length      = trailer.Length;
+    Header.BlocksCount = trailer.BlocksCount;
+  }
+
+  void CommitData( const ulong& headerSize ) {
+    // The streamed writers list the blocks in the trailer,
+    // other streams are discovered by the header chain
+    ZippedStreamTrailer trailer;
+    bool trailed = (Extension.Flags & ZIPPED_STREAM_TRAILER) != 0;
+    if( trailed )
+      ReadTrailer( trailer );
+
+    uint blocksCount = Header.BlocksCount;
+    Blocks = new BlockEntry[blocksCount];
+    memset( Blocks, 0, sizeof( BlockEntry ) * blocksCount );
+    DiscoveredCount   = 0;
+    DiscoveryPosition = headerSize;
+    if( !trailed )
+      return;
+
+    ulong* index = new ulong[blocksCount * 3 + 2];
+    ulong* offsets   = index;
+    ulong* positions = index + blocksCount + 1;
+    ulong* lengths   = index + blocksCount * 2 + 2;
+    ZippedMemory::ReadAt( BaseStream, Memory, index, BasePosition + trailer.IndexPosition, sizeof( ulong ) * (blocksCount * 3 + 2) );
+    if( offsets[blocksCount] != Header.Length ) {
+      delete[] index;
+      ZIPASSERT( false, "Bad zipped stream trailer." );
+    }
+
+    for( uint i = 0; i < blocksCount; i++ ) {
+      auto& block = Blocks[i];
+      block.FilePosition     = BasePosition + positions[i];
+      block.LengthCompressed = lengths[i];
+      block.LengthSource     = offsets[i + 1] - offsets[i];
+    }
+
+    DiscoveredCount   = blocksCount;
+    DiscoveryPosition = positions[blocksCount];
+    delete[] index;
+  }
+
+  void DiscoverBlock( const uint& blockID ) {
+    // Only the block headers up to the needed one are read
+    ZippedBlockHeader blockHeader;
+    while( DiscoveredCount <= blockID ) {
+      ulong position = DiscoveryPosition;
+      if( Extension.Flags & ZIPPED_STREAM_ALIGNED )
+        position = (position + Extension.BlockAlignment - 1) / Extension.BlockAlignment * Extension.BlockAlignment;
+
+      ZippedMemory::ReadAt( BaseStream, Memory, &blockHeader, BasePosition + position, sizeof( blockHeader ) );
+      auto& block = Blocks[DiscoveredCount++];
+      block.FilePosition     = BasePosition + position;
+      block.LengthCompressed = blockHeader.LengthCompressed;
+      block.LengthSource     = blockHeader.LengthSource;
+      DiscoveryPosition = position + sizeof( blockHeader ) + Extension.BlockExtensionSize + blockHeader.LengthCompressed;
+    }
+  }
+
+  BlockEntry* GetBlock( const uint& blockID ) {
+    auto& block = Blocks[blockID];
+    if( block.Loaded )
+      return &block;
+
+    DiscoverBlock( blockID );
+    ZippedBlockExtension blockExtension;
+    memset( &blockExtension, 0, sizeof( blockExtension ) );
+    ulong extensionSize = min( Extension.BlockExtensionSize, sizeof( ZippedBlockExtension ) );
+    ZippedMemory::ReadAt( BaseStream, Memory, &blockExtension, block.FilePosition + sizeof( ZippedBlockHeader ), extensionSize );
+    block.Flags          = blockExtension.Flags;
+    block.Reference      = blockExtension.Reference;
+    block.Filter         = blockExtension.Filter;
+    block.ChecksumSource = blockExtension.ChecksumSource;
+    ZIPASSERT( block.LengthSource <= BlockSize, "Bad zipped block size." );
+    ZIPASSERT( !(block.Flags & ZIPPED_BLOCK_REFERENCE) || block.Reference < blockID, "Bad zipped block reference." );
+    block.Loaded = true;
+    return &block;
+  }
+
+  void Init() {
+    BaseStream    = Null;
+    Memory        = Null;
+    BasePosition  = 0;
+    Dictionary    = Null;
+    Blocks        = Null;
+    DiscoveredCount   = 0;
+    DiscoveryPosition = 0;
+    Position      = 0;
+    CurrentBlock  = Invalid;
+    CurrentLength = 0;
+    Source        = new byte[BlockSize];
+    Compressed    = Null;
+    Filtered      = Null;
+    Verification  = false;
+  }
+
+  void LoadBlock( const uint& blockID ) {
+    auto* block = GetBlock( blockID );
+    CurrentBlock  = Invalid;
+    CurrentLength = block->LengthSource;
+    if( block->Flags & ZIPPED_BLOCK_FILL ) {
+      memset( Source, (byte)block->Reference, CurrentLength );
+      CurrentBlock = blockID;
+      return;
+    }
+
+    if( block->Flags & ZIPPED_BLOCK_REFERENCE )
+      block = GetBlock( block->Reference );
+
+    // The memory streams are inflated in place
+    const byte* data = Null;
+    ulong dataPosition = block->FilePosition + sizeof( ZippedBlockHeader ) + Extension.BlockExtensionSize;
+    if( Memory && dataPosition + block->LengthCompressed <= Memory->GetLength() )
+      data = Memory->GetBuffer() + dataPosition;
+    else {
+      if( !Compressed )
+        Compressed = new byte[compressBound( BlockSize )];
+
+      ZIPASSERT( block->LengthCompressed <= compressBound( BlockSize ), "Bad zipped block size." );
+      ZippedMemory::ReadAt( BaseStream, Memory, Compressed, dataPosition, block->LengthCompressed );
+      data = Compressed;
+    }
+
+    ulong length = BlockSize;
+    bool success = Codec::Decompress( Source, length, data, block->LengthCompressed, Dictionary, Extension.DictionaryLength );
+    ZIPASSERT( success && length == CurrentLength, "Zipped block is corrupted." );
+
+    if( block->Filter != 0 ) {
+      if( !Filtered )
+        Filtered = new byte[BlockSize];
+
+      if( ZippedKernels::RemoveFilter( block->Filter, Source, Filtered, length ) ) {
+        byte* source = Source;
+        Source   = Filtered;
+        Filtered = source;
+      }
+    }
+
+    if( Verification && (block->Flags & ZIPPED_BLOCK_CHECKSUM) )
+      ZIPASSERT( ZippedChecksum::Compute( Source, length ) == block->ChecksumSource, "Zipped block is corrupted." );
+
+    CurrentBlock = blockID;
+  }
+
+  ulong ReadBlocks( byte* buffer, const ulong& length ) {
+    ulong readedTotal = 0;
+    while( readedTotal < length && Position < Header.Length ) {
+      uint blockID = Position >> BlockShift;
+      if( blockID != CurrentBlock )
+        LoadBlock( blockID );
+
+      ulong blockPosition = Position & BlockMask;
+      ulong readed = min( length - readedTotal, CurrentLength - blockPosition );
+      memcpy( buffer + readedTotal, Source + blockPosition, readed );
+      Position    += readed;
+      readedTotal += readed;
+    }
+
+    return readedTotal;
+  }
+
+public:
+  BasicZippedReader( FILE* baseStream, long position = 0 ) {
+    ZIPASSERT( baseStream != Null, "Can not create a zipped stream. Base stream is Null." );
+    Init();
+    BaseStream   = baseStream;
+    BasePosition = position;
+    CommitHeader();
+  }
+
+  BasicZippedReader( ZippedMemory* memory ) {
+    ZIPASSERT( memory != Null, "Can not create a zipped stream. Memory is Null." );
+    Init();
+    Memory = memory;
+    CommitHeader();
+  }
+
+  // The reader owns its buffers, so it is not copied
+  BasicZippedReader( const BasicZippedReader& ) = delete;
+  BasicZippedReader& operator = ( const BasicZippedReader& ) = delete;
+
+  void SetVerification( const bool& enabled ) {
+    Verification = enabled;
+  }
+
+  ulong Tell() {
+    return Position;
+  }
+
+  ulong Seek( const ulong& position ) {
+    if( position <= Header.Length )
+      Position = position;
+
+    return Position;
+  }
+
+  __forceinline ulong Read( byte* buffer, const ulong& length ) {
+    // Fast path of the reads inside the current block
+    ulong blockPosition = Position & BlockMask;
+    if( (Position >> BlockShift) == CurrentBlock && blockPosition + length <= CurrentLength ) {
+      memcpy( buffer, Source + blockPosition, length );
+      Position += length;
+      return length;
+    }
+
+    return ReadBlocks( buffer, length );
+  }
+
+  bool EndOfFile() {
+    return Position >= Header.Length;
+  }
+
+  ulong GetLength() {
+    return Header.Length;
+  }
+
+  uint GetBlocksCount() {
+    return Header.BlocksCount;
+  }
+
+  ~BasicZippedReader() {
+    delete[] Source;
+    delete[] Compressed;
+    delete[] Filtered;
+    delete[] Blocks;
+    delete[] Dictionary;
+  }
+};
+
+// Reader of the streams written with the default block size
+typedef BasicZippedReader<ZippedDeflateCodec, 18> ZippedDefaultReader;
@@ -6,6 +6,13 @@ void ZippedBufferProto::SetBuffer( byte* buffer, const ulong& length ) {
   Length = length;
 }
 
+void ZippedBufferProto::SetView( byte* buffer, const ulong& length ) {
+  Clear();
+  Buffer   = buffer;
+  Length   = length;
+  Borrowed = true;
+}
+
 byte* ZippedBufferProto::GetBuffer() {
   return Buffer;
 }
@@ -25,11 +32,23 @@ ulong ZippedBufferProto::Write( byte* buffer, const ulong& length ) {
   return toWrite;
 }
 
+ulong ZippedBufferProto::Fill( const byte& value, const ulong& length ) {
+  if( !Buffer )
+    Buffer = new byte[Parent->LengthMax];
+
+  uint memLeft = Parent->LengthMax - Length;
+  uint toFill = min( length, memLeft );
+  memset( Buffer + Length, value, toFill );
+  Length += toFill;
+  return toFill;
+}
+
 void ZippedBufferProto::Clear() {
-  if( Buffer != Null )
+  if( Buffer != Null && !Borrowed )
     delete[] Buffer;
   Buffer = Null;
   Length = 0;
+  Borrowed = false;
 }
 
 ZippedBufferProto::~ZippedBufferProto() {
@@ -40,32 +59,96 @@ ZippedBufferProto::~ZippedBufferProto() {
 
 
 ZippedBuffer::ZippedBuffer() {
-  LengthMax         = BLOCK_SIZE_DEFAULT;
-  Source.Buffer     = Null;
-  Source.Length     = 0;
-  Source.Parent     = this;
-  Compressed.Buffer = Null;
-  Compressed.Length = 0;
-  Compressed.Parent = this;
-  AsyncContext      = Null;
+  LengthMax           = BLOCK_SIZE_DEFAULT;
+  Source.Buffer       = Null;
+  Source.Length       = 0;
+  Source.Parent       = this;
+  Source.Borrowed     = false;
+  Compressed.Buffer   = Null;
+  Compressed.Length   = 0;
+  Compressed.Parent   = this;
+  Compressed.Borrowed = false;
+  AsyncContext        = Null;
+  Dictionary          = Null;
+  DictionaryLength    = 0;
+  Filter              = 0;
+  Level               = Z_DEFAULT_COMPRESSION;
+  Verification        = false;
+  HasChecksum         = false;
+  Checksum            = 0;
+  Corrupted           = false;
+  Loading             = false;
+  LoadEvent           = Null;
 }
 
 ZippedBuffer::ZippedBuffer( const ulong& length ) {
-  LengthMax         = length;
-  Source.Buffer     = Null;
-  Source.Length     = 0;
-  Source.Parent     = this;
-  Compressed.Buffer = Null;
-  Compressed.Length = 0;
-  Compressed.Parent = this;
-  AsyncContext      = Null;
+  LengthMax           = length;
+  Source.Buffer       = Null;
+  Source.Length       = 0;
+  Source.Parent       = this;
+  Source.Borrowed     = false;
+  Compressed.Buffer   = Null;
+  Compressed.Length   = 0;
+  Compressed.Parent   = this;
+  Compressed.Borrowed = false;
+  AsyncContext        = Null;
+  Dictionary          = Null;
+  DictionaryLength    = 0;
+  Filter              = 0;
+  Level               = Z_DEFAULT_COMPRESSION;
+  Verification        = false;
+  HasChecksum         = false;
+  Checksum            = 0;
+  Corrupted           = false;
+  Loading             = false;
+  LoadEvent           = Null;
+}
+
+void ZippedBuffer::SetDictionary( byte* dictionary, const ulong& length ) {
+  Dictionary = dictionary;
+  DictionaryLength = dictionary ? length : 0;
+}
+
+void ZippedBuffer::SetFilter( const ulong& filter ) {
+  Filter = filter;
+}
+
+void ZippedBuffer::SetLevel( const int& level ) {
+  Level = level;
+}
+
+void ZippedBuffer::SetVerification( const bool& enabled, const bool& hasChecksum, const ulong& checksum ) {
+  Verification = enabled;
+  HasChecksum  = enabled && hasChecksum;
+  Checksum     = checksum;
 }
 
 void ZippedBuffer::Compress() {
-  Compressed.Length = compressBound( Source.Length );
+  CompressFrom( Source.Buffer, Source.Length );
+}
+
+void ZippedBuffer::CompressFrom( const byte* buffer, const ulong& length ) {
+  // The dictionary id adds 4 bytes to the zlib header
+  Compressed.Length = compressBound( length ) + (Dictionary ? 4 : 0);
   Compressed.Buffer = (byte*)shi_realloc( Compressed.Buffer, Compressed.Length );
   ZIPASSERT( Compressed.Buffer != Null, "Can not alloc buffer. Out of memory." );
-  int result = compress( Compressed.Buffer, &Compressed.Length, Source.Buffer, Source.Length );
+
+  const byte* source = buffer;
+  byte* filtered = Null;
+  if( Filter != 0 ) {
+    filtered = (byte*)shi_malloc( length );
+    ZIPASSERT( filtered != Null, "Can not alloc buffer. Out of memory." );
+    ZippedKernels::ApplyFilter( Filter, buffer, filtered, length );
+    source = filtered;
+  }
+
+  int result = Dictionary ?
+    CompressWithDictionary( source, length ) :
+    compress2( Compressed.Buffer, &Compressed.Length, source, length, Level );
+
+  if( filtered != Null )
+    shi_free( filtered );
+
   ZIPASSERT( result == Z_OK, "Compress failed!" );
   Compressed.Buffer = (byte*)shi_realloc( Compressed.Buffer, Compressed.Length );
 }
@@ -86,9 +169,29 @@ void ZippedBuffer::DecompressAsync() {
   Source.Length = compressBound( LengthMax );
   Source.Buffer = (byte*)shi_realloc( Source.Buffer, Source.Length );
   ZIPASSERT( Source.Buffer != Null, "Can not alloc buffer. Out of memory." );
-  int result = uncompress( Source.Buffer, &Source.Length, Compressed.Buffer, Compressed.Length );
-  ZIPASSERT( result == Z_OK, "Decompress failed." );
-  Source.Buffer = (byte*)shi_realloc( Source.Buffer, Source.Length );
+  int result = Dictionary ?
+    DecompressWithDictionary() :
+    uncompress( Source.Buffer, &Source.Length, Compressed.Buffer, Compressed.Length );
+  // With the verification the error is reported by the
+  // Corrupted flag, so the worker thread does not throw
+  Corrupted = result != Z_OK;
+  ZIPASSERT( !Corrupted || Verification, "Decompress failed." );
+  if( !Corrupted ) {
+    Source.Buffer = (byte*)shi_realloc( Source.Buffer, Source.Length );
+
+    if( Filter != 0 ) {
+      // Delta is removed in place, shuffles need another buffer
+      byte* source = (byte*)shi_malloc( Source.Length );
+      ZIPASSERT( source != Null, "Can not alloc buffer. Out of memory." );
+      bool moved = ZippedKernels::RemoveFilter( Filter, Source.Buffer, source, Source.Length );
+      shi_free( moved ? Source.Buffer : source );
+      if( moved )
+        Source.Buffer = source;
+    }
+
+    if( HasChecksum )
+      Corrupted = ZippedChecksum::Compute( Source.Buffer, Source.Length ) != Checksum;
+  }
 
   DecompressContextMutex.Enter();
   if( AsyncContext ) {
@@ -99,6 +202,69 @@ void ZippedBuffer::DecompressAsync() {
   DecompressContextMutex.Leave();
 }
 
+int ZippedBuffer::CompressWithDictionary( const byte* source, const ulong& length ) {
+  z_stream stream;
+  memset( &stream, 0, sizeof( stream ) );
+  int result = deflateInit( &stream, Level );
+  if( result != Z_OK )
+    return result;
+
+  result = deflateSetDictionary( &stream, Dictionary, DictionaryLength );
+  if( result == Z_OK ) {
+    stream.next_in   = (Bytef*)source;
+    stream.avail_in  = length;
+    stream.next_out  = Compressed.Buffer;
+    stream.avail_out = Compressed.Length;
+    result = deflate( &stream, Z_FINISH );
+    result = result == Z_STREAM_END ? Z_OK : Z_BUF_ERROR;
+  }
+
+  Compressed.Length = stream.total_out;
+  deflateEnd( &stream );
+  return result;
+}
+
+int ZippedBuffer::DecompressWithDictionary() {
+  z_stream stream;
+  memset( &stream, 0, sizeof( stream ) );
+  int result = inflateInit( &stream );
+  if( result != Z_OK )
+    return result;
+
+  stream.next_in   = Compressed.Buffer;
+  stream.avail_in  = Compressed.Length;
+  stream.next_out  = Source.Buffer;
+  stream.avail_out = Source.Length;
+  result = inflate( &stream, Z_FINISH );
+  if( result == Z_NEED_DICT ) {
+    result = inflateSetDictionary( &stream, Dictionary, DictionaryLength );
+    if( result == Z_OK )
+      result = inflate( &stream, Z_FINISH );
+  }
+
+  result = result == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+  Source.Length = stream.total_out;
+  inflateEnd( &stream );
+  return result;
+}
+
+void ZippedBuffer::BeginLoad() {
+  if( LoadEvent == Null )
+    LoadEvent = CreateEvent( Null, True, False, Null );
+
+  DecompressContextMutex.Enter();
+  Loading = true;
+  ResetEvent( LoadEvent );
+  DecompressContextMutex.Leave();
+}
+
+void ZippedBuffer::EndLoad() {
+  DecompressContextMutex.Enter();
+  Loading = false;
+  SetEvent( LoadEvent );
+  DecompressContextMutex.Leave();
+}
+
 void ZippedBuffer::Clear() {
   WaitForDecompress();
   Source.Clear();
@@ -117,6 +283,14 @@ bool ZippedBuffer::IsDecompressed() {
 }
 
 void ZippedBuffer::WaitForDecompress() {
+  // The load hands the data to the decompression before it ends
+  DecompressContextMutex.Enter();
+  HANDLE loadEvent = Loading ? LoadEvent : Null;
+  DecompressContextMutex.Leave();
+
+  if( loadEvent != Null )
+    WaitForSingleObject( loadEvent, INFINITE );
+
   DecompressContextMutex.Enter();
   HANDLE event = AsyncContext ? AsyncContext->WaitForEnd : Null;
   DecompressContextMutex.Leave();
@@ -127,13 +301,15 @@ void ZippedBuffer::WaitForDecompress() {
 
 bool ZippedBuffer::DecompressIsActive() {
   DecompressContextMutex.Enter();
-  bool value = AsyncContext != Null;
+  bool value = AsyncContext != Null || Loading;
   DecompressContextMutex.Leave();
   return value;
 }
 
 ZippedBuffer::~ZippedBuffer() {
   WaitForDecompress();
+  if( LoadEvent != Null )
+    CloseHandle( LoadEvent );
 }
 
 
@@ -174,6 +350,9 @@ AsyncContext& ZippedBuffer_AsyncHelper::GetNextThread() {
 }
 
 AsyncContext& ZippedBuffer_AsyncHelper::Start( ZippedBuffer* owner, void(__thiscall ZippedBuffer::* func)() ) {
+  // Any thread can start a job, so a context is taken
+  // and waited under the lock and gets only one job
+  StartMutex.Enter();
   AsyncContext& con = GetNextThread();
   WaitForSingleObject( con.WaitForEnd, INFINITE );
   ResetEvent( con.WaitForEnd );
@@ -181,6 +360,7 @@ AsyncContext& ZippedBuffer_AsyncHelper::Start( ZippedBuffer* owner, void(__thisc
   con.Function = func;
   con.UseOneBuffer = True;
   SetEvent( con.WaitForStart );
+  StartMutex.Leave();
   return con;
 }
 
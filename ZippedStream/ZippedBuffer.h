@@ -10,12 +10,15 @@ class ZSTREAMAPI ZippedBufferProto {
   ZippedBuffer* Parent;
   byte* Buffer;
   ulong Length;
+  bool Borrowed; // The buffer is not owned and is never changed
 
 public:
   void SetBuffer( byte* buffer, const ulong& length );
+  void SetView( byte* buffer, const ulong& length );
   byte* GetBuffer();
   ulong GetLength();
   ulong Write( byte* buffer, const ulong& length );
+  ulong Fill( const byte& value, const ulong& length );
   void Clear();
   ~ZippedBufferProto();
 };
@@ -24,6 +27,16 @@ public:
 
 struct ZSTREAMAPI ZippedBuffer {
   ulong LengthMax; // Maximum length of the buffer
+  byte* Dictionary; // Preset dictionary, owned by the stream
+  ulong DictionaryLength;
+  ulong Filter; // Pre-filter applied to Source before deflate
+  int Level;    // Deflate compression level
+  bool Verification; // Errors of inflate set Corrupted instead of throwing
+  bool HasChecksum;
+  ulong Checksum;    // Expected checksum of the Source
+  bool Corrupted;
+  bool Loading;   // Compressed data is being read by the I/O workers
+  HANDLE LoadEvent;
   ZippedBufferProto Source;
   ZippedBufferProto Compressed;
   AsyncContext* AsyncContext;
@@ -31,8 +44,15 @@ struct ZSTREAMAPI ZippedBuffer {
 
   ZippedBuffer();
   ZippedBuffer( const ulong& length );
+  void SetDictionary( byte* dictionary, const ulong& length );
+  void SetFilter( const ulong& filter );
+  void SetLevel( const int& level );
+  void SetVerification( const bool& enabled, const bool& hasChecksum = false, const ulong& checksum = 0 );
   void Compress();
+  void CompressFrom( const byte* source, const ulong& length );
   void Decompress( bool async );
+  void BeginLoad();
+  void EndLoad();
   void Clear();
   bool IsCompressed();
   bool IsDecompressed();
@@ -42,6 +62,8 @@ struct ZSTREAMAPI ZippedBuffer {
 
 protected:
   void DecompressAsync();
+  int CompressWithDictionary( const byte* source, const ulong& length );
+  int DecompressWithDictionary();
 };
 
 
@@ -64,6 +86,7 @@ struct ZSTREAMAPI AsyncContext {
 struct ZSTREAMAPI ZippedBuffer_AsyncHelper {
   Common::Array<AsyncContext> Contexts;
   uint Iterator;
+  Common::ThreadLocker StartMutex; // Serializes the Start calls
 
   ZippedBuffer_AsyncHelper( const uint& threads_count );
   AsyncContext& GetNextThread();
@@ -0,0 +1,189 @@
+#include "ZippedAfx.h"
+#include <intrin.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+
+static const uint Polynomial = 0x82F63B78; // Reflected CRC32C
+static const uint LaneSize   = 1024 * 8;   // Bytes per stream of the hardware loop
+
+enum {
+  CRC_SOFTWARE,
+  CRC_SSE42,
+  CRC_PCLMUL
+};
+
+static int DetectCrcLevel() {
+  int info[4];
+  __cpuid( info, 1 );
+  bool sse42  = (info[2] & (1 << 20)) != 0;
+  bool pclmul = (info[2] & (1 << 1))  != 0;
+  if( !sse42 )
+    return CRC_SOFTWARE;
+
+  return pclmul ? CRC_PCLMUL : CRC_SSE42;
+}
+
+static int GetCrcLevel() {
+  static int level = DetectCrcLevel();
+  return level;
+}
+
+
+
+#pragma region software
+static struct ZippedCrcTable {
+  uint Values[8][256];
+
+  ZippedCrcTable() {
+    for( uint i = 0; i < 256; i++ ) {
+      uint crc = i;
+      for( uint bit = 0; bit < 8; bit++ )
+        crc = crc & 1 ? (crc >> 1) ^ Polynomial : crc >> 1;
+
+      Values[0][i] = crc;
+    }
+
+    for( uint i = 0; i < 256; i++ )
+      for( uint slice = 1; slice < 8; slice++ )
+        Values[slice][i] = (Values[slice - 1][i] >> 8) ^ Values[0][Values[slice - 1][i] & 0xFF];
+  }
+}
+CrcTable;
+
+// Works with the raw register, without the
+// initial and the final inversion of the value
+static uint UpdateSoftware( uint crc, const byte* buffer, uint length ) {
+  for( ; length >= 8; length -= 8, buffer += 8 ) {
+    uint low, high;
+    memcpy( &low,  buffer,     4 );
+    memcpy( &high, buffer + 4, 4 );
+    low ^= crc;
+    crc = CrcTable.Values[7][low & 0xFF]          ^ CrcTable.Values[6][(low >> 8) & 0xFF] ^
+          CrcTable.Values[5][(low >> 16) & 0xFF]  ^ CrcTable.Values[4][low >> 24] ^
+          CrcTable.Values[3][high & 0xFF]         ^ CrcTable.Values[2][(high >> 8) & 0xFF] ^
+          CrcTable.Values[1][(high >> 16) & 0xFF] ^ CrcTable.Values[0][high >> 24];
+  }
+
+  for( ; length > 0; length--, buffer++ )
+    crc = (crc >> 8) ^ CrcTable.Values[0][(crc ^ *buffer) & 0xFF];
+
+  return crc;
+}
+
+// Multiplication of the polynomials modulo the CRC polynomial.
+// The bit 31 is x^0, the same order as in the CRC register.
+static uint MultiplyModP( uint a, uint b ) {
+  uint product = 0;
+  for( uint mask = 0x80000000; mask != 0; mask >>= 1 ) {
+    if( a & mask )
+      product ^= b;
+
+    b = b & 1 ? (b >> 1) ^ Polynomial : b >> 1;
+  }
+
+  return product;
+}
+
+// x^power modulo the CRC polynomial
+static uint PowerModP( ULONGLONG power ) {
+  uint result = 0x80000000;
+  uint square = 0x40000000;
+  for( ; power > 0; power >>= 1 ) {
+    if( power & 1 )
+      result = MultiplyModP( result, square );
+
+    square = MultiplyModP( square, square );
+  }
+
+  return result;
+}
+#pragma endregion
+
+
+
+#pragma region hardware
+static inline uint UpdateByte( const uint& crc, const byte* buffer ) {
+  return _mm_crc32_u8( crc, *buffer );
+}
+
+static inline uint UpdateWord( const uint& crc, const byte* buffer ) {
+#ifdef _M_X64
+  ULONGLONG value;
+  memcpy( &value, buffer, 8 );
+  return (uint)_mm_crc32_u64( crc, value );
+#else
+  uint low, high;
+  memcpy( &low,  buffer,     4 );
+  memcpy( &high, buffer + 4, 4 );
+  return _mm_crc32_u32( _mm_crc32_u32( crc, low ), high );
+#endif
+}
+
+// Shift constants of the lanes for the PCLMUL merge. The carry-less
+// product adds one power of x and the crc32 reduction adds 32 more.
+static struct ZippedCrcShifts {
+  uint Lane;
+  uint TwoLanes;
+  uint LaneSoftware;
+  uint TwoLanesSoftware;
+
+  ZippedCrcShifts() {
+    Lane             = PowerModP( LaneSize * 8 - 33 );
+    TwoLanes         = PowerModP( LaneSize * 16 - 33 );
+    LaneSoftware     = PowerModP( LaneSize * 8 );
+    TwoLanesSoftware = PowerModP( LaneSize * 16 );
+  }
+}
+CrcShifts;
+
+static inline uint ShiftPclmul( const uint& crc, const uint& constant ) {
+  __m128i product = _mm_clmulepi64_si128( _mm_cvtsi32_si128( crc ), _mm_cvtsi32_si128( constant ), 0 );
+  byte bytes[16];
+  _mm_storeu_si128( (__m128i*)bytes, product );
+  return UpdateWord( 0, bytes );
+}
+
+static uint UpdateHardware( uint crc, const byte* buffer, uint length ) {
+  // Align the data for the word loads
+  for( ; length > 0 && ((size_t)buffer & 7) != 0; length--, buffer++ )
+    crc = UpdateByte( crc, buffer );
+
+  // The crc32 instruction has a latency of 3 cycles and a
+  // throughput of 1, so three independent streams fill the pipeline
+  bool pclmul = GetCrcLevel() == CRC_PCLMUL;
+  for( ; length >= LaneSize * 3; length -= LaneSize * 3, buffer += LaneSize * 3 ) {
+    uint crc1 = 0;
+    uint crc2 = 0;
+    for( uint i = 0; i < LaneSize; i += 8 ) {
+      crc  = UpdateWord( crc,  buffer + i );
+      crc1 = UpdateWord( crc1, buffer + i + LaneSize );
+      crc2 = UpdateWord( crc2, buffer + i + LaneSize * 2 );
+    }
+
+    crc = pclmul ?
+      ShiftPclmul( crc, CrcShifts.TwoLanes ) ^ ShiftPclmul( crc1, CrcShifts.Lane ) ^ crc2 :
+      MultiplyModP( CrcShifts.TwoLanesSoftware, crc ) ^ MultiplyModP( CrcShifts.LaneSoftware, crc1 ) ^ crc2;
+  }
+
+  for( ; length >= 8; length -= 8, buffer += 8 )
+    crc = UpdateWord( crc, buffer );
+
+  for( ; length > 0; length--, buffer++ )
+    crc = UpdateByte( crc, buffer );
+
+  return crc;
+}
+#pragma endregion
+
+
+
+ulong ZippedChecksum::Compute( const byte* buffer, const ulong& length, const ulong& crc ) {
+  if( GetCrcLevel() == CRC_SOFTWARE )
+    return ComputeSoftware( buffer, length, crc );
+
+  return ~UpdateHardware( ~(uint)crc, buffer, length );
+}
+
+ulong ZippedChecksum::ComputeSoftware( const byte* buffer, const ulong& length, const ulong& crc ) {
+  return ~UpdateSoftware( ~(uint)crc, buffer, length );
+}
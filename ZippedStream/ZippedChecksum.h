@@ -0,0 +1,11 @@
+#pragma once
+
+
+
+// CRC32C (Castagnoli) of the block data. SSE4.2 crc32 instructions
+// are used when the CPU supports them, three independent streams
+// are merged with PCLMUL. Otherwise a slicing-by-8 table is used.
+struct ZSTREAMAPI ZippedChecksum {
+  static ulong Compute( const byte* buffer, const ulong& length, const ulong& crc = 0 );
+  static ulong ComputeSoftware( const byte* buffer, const ulong& length, const ulong& crc = 0 );
+};
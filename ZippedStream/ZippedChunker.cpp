@@ -0,0 +1,88 @@
+#include "ZippedAfx.h"
+
+static struct ZippedGearTable {
+  ULONGLONG Values[256];
+
+  ZippedGearTable() {
+    // splitmix64 sequence, fixed so boundaries are stable between builds
+    ULONGLONG state = 0x2545F4914F6CDD1DULL;
+    for( uint i = 0; i < 256; i++ ) {
+      ULONGLONG value = (state += 0x9E3779B97F4A7C15ULL);
+      value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+      Values[i] = value ^ (value >> 31);
+    }
+  }
+}
+GearTable;
+
+
+
+static ULONGLONG GetHighBitsMask( uint bits ) {
+  bits = max( 1u, min( bits, 63u ) );
+  return ~0ULL << (64 - bits);
+}
+
+ZippedChunker::ZippedChunker() {
+  SetSizes( BLOCK_SIZE_DEFAULT / 4, BLOCK_SIZE_DEFAULT / 2, BLOCK_SIZE_DEFAULT );
+}
+
+void ZippedChunker::SetSizes( const ulong& minSize, const ulong& averageSize, const ulong& maxSize ) {
+  ZIPASSERT( minSize <= averageSize && averageSize <= maxSize && maxSize > 0, "Bad zipped chunk sizes." );
+  MinSize     = minSize;
+  AverageSize = averageSize;
+  MaxSize     = maxSize;
+
+  uint bits = 0;
+  while( (2ul << bits) <= averageSize )
+    bits++;
+
+  MaskSmall = GetHighBitsMask( bits + 2 );
+  MaskLarge = GetHighBitsMask( bits > 2 ? bits - 2 : 1 );
+  Reset();
+}
+
+ulong ZippedChunker::GetMinSize() {
+  return MinSize;
+}
+
+ulong ZippedChunker::GetAverageSize() {
+  return AverageSize;
+}
+
+ulong ZippedChunker::GetMaxSize() {
+  return MaxSize;
+}
+
+ulong ZippedChunker::Scan( const byte* buffer, const ulong& length, const ulong& chunkLength ) {
+  for( ulong i = 0; i < length; i++ ) {
+    ulong size = chunkLength + i + 1;
+    if( size >= MaxSize ) {
+      Finished = true;
+      return i + 1;
+    }
+
+    // Boundaries are never placed before the minimum size,
+    // so the hash of these bytes is not needed
+    if( size <= MinSize )
+      continue;
+
+    Hash = (Hash << 1) + GearTable.Values[buffer[i]];
+    ULONGLONG mask = size < AverageSize ? MaskSmall : MaskLarge;
+    if( (Hash & mask) == 0 ) {
+      Finished = true;
+      return i + 1;
+    }
+  }
+
+  return length;
+}
+
+bool ZippedChunker::IsFinished() {
+  return Finished;
+}
+
+void ZippedChunker::Reset() {
+  Hash = 0;
+  Finished = false;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+
+
+// Content defined chunking with a gear rolling hash (FastCDC).
+// Boundaries depend only on the data near them, so an insertion
+// shifts the boundaries just around the changed region.
+class ZSTREAMAPI ZippedChunker {
+  ulong MinSize;
+  ulong AverageSize;
+  ulong MaxSize;
+  ULONGLONG MaskSmall; // Harder mask before the average size
+  ULONGLONG MaskLarge; // Easier mask after the average size
+  ULONGLONG Hash;
+  bool Finished;
+
+public:
+  ZippedChunker();
+  void SetSizes( const ulong& minSize, const ulong& averageSize, const ulong& maxSize );
+  ulong GetMinSize();
+  ulong GetAverageSize();
+  ulong GetMaxSize();
+  ulong Scan( const byte* buffer, const ulong& length, const ulong& chunkLength );
+  bool IsFinished();
+  void Reset();
+};
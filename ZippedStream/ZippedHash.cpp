@@ -0,0 +1,192 @@
+#include "ZippedAfx.h"
+#if defined( _M_X64 ) || _M_IX86_FP >= 2 || defined( __SSE2__ )
+#define ZIPPED_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+static const ULONGLONG Prime64_1 = 0x9E3779B185EBCA87ULL;
+static const ULONGLONG Prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const ULONGLONG Prime64_3 = 0x165667B19E3779F9ULL;
+static const ULONGLONG Prime32_1 = 0x9E3779B1ULL;
+static const uint StripeSize     = 32;
+static const uint StripesInBlock = 32; // Scramble accumulators every 1KB
+
+static const ULONGLONG StripeKey[4] = {
+  0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL,
+  0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL
+};
+
+static const ULONGLONG ScrambleKey[4] = {
+  0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL,
+  0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+};
+
+
+
+static inline ULONGLONG Rotl64( const ULONGLONG& value, const uint& shift ) {
+  return (value << shift) | (value >> (64 - shift));
+}
+
+static inline ULONGLONG Avalanche( ULONGLONG value ) {
+  value ^= value >> 33;
+  value *= Prime64_2;
+  value ^= value >> 29;
+  value *= Prime64_3;
+  value ^= value >> 32;
+  return value;
+}
+
+static inline void AccumulateStripe( ULONGLONG* acc, const byte* stripe ) {
+  for( uint i = 0; i < 4; i++ ) {
+    ULONGLONG data;
+    memcpy( &data, stripe + i * 8, 8 );
+    ULONGLONG key = data ^ StripeKey[i];
+    acc[i ^ 1] += data;
+    acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+  }
+}
+
+static inline void ScrambleAccumulators( ULONGLONG* acc ) {
+  for( uint i = 0; i < 4; i++ ) {
+    acc[i] ^= acc[i] >> 47;
+    acc[i] ^= ScrambleKey[i];
+    acc[i] *= Prime32_1;
+  }
+}
+
+#ifdef ZIPPED_HASH_SSE2
+// Same math as the scalar functions above, two lanes per register
+static void AccumulateStripes( ULONGLONG* acc, const byte* buffer, const ulong& stripesCount ) {
+  __m128i acc0 = _mm_loadu_si128( (const __m128i*)&acc[0] );
+  __m128i acc1 = _mm_loadu_si128( (const __m128i*)&acc[2] );
+  const __m128i key0 = _mm_loadu_si128( (const __m128i*)&StripeKey[0] );
+  const __m128i key1 = _mm_loadu_si128( (const __m128i*)&StripeKey[2] );
+  const __m128i scramble0 = _mm_loadu_si128( (const __m128i*)&ScrambleKey[0] );
+  const __m128i scramble1 = _mm_loadu_si128( (const __m128i*)&ScrambleKey[2] );
+  const __m128i prime = _mm_set1_epi32( (int)Prime32_1 );
+
+  for( ulong i = 0; i < stripesCount; i++ ) {
+    const byte* stripe = buffer + i * StripeSize;
+    __m128i data0 = _mm_loadu_si128( (const __m128i*)(stripe) );
+    __m128i data1 = _mm_loadu_si128( (const __m128i*)(stripe + 16) );
+    __m128i mixed0 = _mm_xor_si128( data0, key0 );
+    __m128i mixed1 = _mm_xor_si128( data1, key1 );
+    __m128i product0 = _mm_mul_epu32( mixed0, _mm_shuffle_epi32( mixed0, _MM_SHUFFLE( 0, 3, 0, 1 ) ) );
+    __m128i product1 = _mm_mul_epu32( mixed1, _mm_shuffle_epi32( mixed1, _MM_SHUFFLE( 0, 3, 0, 1 ) ) );
+    acc0 = _mm_add_epi64( acc0, _mm_shuffle_epi32( data0, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    acc1 = _mm_add_epi64( acc1, _mm_shuffle_epi32( data1, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    acc0 = _mm_add_epi64( acc0, product0 );
+    acc1 = _mm_add_epi64( acc1, product1 );
+
+    if( (i + 1) % StripesInBlock == 0 ) {
+      acc0 = _mm_xor_si128( acc0, _mm_srli_epi64( acc0, 47 ) );
+      acc1 = _mm_xor_si128( acc1, _mm_srli_epi64( acc1, 47 ) );
+      acc0 = _mm_xor_si128( acc0, scramble0 );
+      acc1 = _mm_xor_si128( acc1, scramble1 );
+      __m128i low0  = _mm_mul_epu32( acc0, prime );
+      __m128i low1  = _mm_mul_epu32( acc1, prime );
+      __m128i high0 = _mm_mul_epu32( _mm_srli_epi64( acc0, 32 ), prime );
+      __m128i high1 = _mm_mul_epu32( _mm_srli_epi64( acc1, 32 ), prime );
+      acc0 = _mm_add_epi64( low0, _mm_slli_epi64( high0, 32 ) );
+      acc1 = _mm_add_epi64( low1, _mm_slli_epi64( high1, 32 ) );
+    }
+  }
+
+  _mm_storeu_si128( (__m128i*)&acc[0], acc0 );
+  _mm_storeu_si128( (__m128i*)&acc[2], acc1 );
+}
+#else
+static void AccumulateStripes( ULONGLONG* acc, const byte* buffer, const ulong& stripesCount ) {
+  for( ulong i = 0; i < stripesCount; i++ ) {
+    AccumulateStripe( acc, buffer + i * StripeSize );
+    if( (i + 1) % StripesInBlock == 0 )
+      ScrambleAccumulators( acc );
+  }
+}
+#endif
+
+
+
+bool ZippedHash::operator == ( const ZippedHash& other ) const {
+  return Low == other.Low && High == other.High;
+}
+
+ZippedHash ZippedHash::Compute( const byte* buffer, const ulong& length ) {
+  ULONGLONG acc[4] = { Prime32_1, Prime64_1, Prime64_2, Prime64_3 };
+  ulong stripesCount = length / StripeSize;
+  AccumulateStripes( acc, buffer, stripesCount );
+
+  ulong tailLength = length - stripesCount * StripeSize;
+  if( tailLength > 0 ) {
+    byte tail[StripeSize];
+    memset( tail, 0, StripeSize );
+    memcpy( tail, buffer + stripesCount * StripeSize, tailLength );
+    AccumulateStripe( acc, tail );
+  }
+
+  ZippedHash hash;
+  hash.Low  = Avalanche( acc[0] + Rotl64( acc[1], 17 ) * Prime64_1 + Rotl64( acc[2], 31 ) + acc[3] * Prime64_2 + length );
+  hash.High = Avalanche( acc[3] + Rotl64( acc[2], 23 ) * Prime64_1 + Rotl64( acc[1], 41 ) + acc[0] * Prime64_3 + ~(ULONGLONG)length );
+  return hash;
+}
+
+
+
+ZippedHashTable::ZippedHashTable() {
+  Entries  = Null;
+  Capacity = 0;
+  Count    = 0;
+}
+
+uint ZippedHashTable::Find( const ZippedHash& hash ) {
+  if( Capacity == 0 )
+    return Invalid;
+
+  uint mask = Capacity - 1;
+  for( uint i = (uint)hash.Low & mask; Entries[i].ID != Invalid; i = (i + 1) & mask )
+    if( Entries[i].Hash == hash )
+      return Entries[i].ID;
+
+  return Invalid;
+}
+
+void ZippedHashTable::Insert( const ZippedHash& hash, const uint& id ) {
+  if( (Count + 1) * 2 > Capacity )
+    Grow();
+
+  uint mask = Capacity - 1;
+  uint i = (uint)hash.Low & mask;
+  while( Entries[i].ID != Invalid )
+    i = (i + 1) & mask;
+
+  Entries[i].Hash = hash;
+  Entries[i].ID   = id;
+  Count++;
+}
+
+void ZippedHashTable::Grow() {
+  Entry* entries = Entries;
+  uint capacity = Capacity;
+  Capacity = capacity ? capacity * 2 : 64;
+  Entries = new Entry[Capacity];
+  for( uint i = 0; i < Capacity; i++ )
+    Entries[i].ID = Invalid;
+
+  Count = 0;
+  for( uint i = 0; i < capacity; i++ )
+    if( entries[i].ID != Invalid )
+      Insert( entries[i].Hash, entries[i].ID );
+
+  delete[] entries;
+}
+
+void ZippedHashTable::Clear() {
+  delete[] Entries;
+  Entries  = Null;
+  Capacity = 0;
+  Count    = 0;
+}
+
+ZippedHashTable::~ZippedHashTable() {
+  Clear();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+
+
+// 128-bit fingerprint of the block data. The main loop
+// uses SSE2 multiply-accumulate over 32-byte stripes.
+struct ZSTREAMAPI ZippedHash {
+  ULONGLONG Low;
+  ULONGLONG High;
+
+  bool operator == ( const ZippedHash& other ) const;
+  static ZippedHash Compute( const byte* buffer, const ulong& length );
+};
+
+
+
+// Open addressing table which maps a fingerprint to the block ID
+class ZSTREAMAPI ZippedHashTable {
+  struct Entry {
+    ZippedHash Hash;
+    uint ID;
+  };
+
+  Entry* Entries;
+  uint Capacity;
+  uint Count;
+
+  void Grow();
+
+public:
+  ZippedHashTable();
+  uint Find( const ZippedHash& hash );
+  void Insert( const ZippedHash& hash, const uint& id );
+  void Clear();
+  ~ZippedHashTable();
+};
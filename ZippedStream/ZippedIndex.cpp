@@ -0,0 +1,76 @@
+#include "ZippedAfx.h"
+
+bool ZippedIndex::GetFileStamp( FILE* file, ULONGLONG& size, ULONGLONG& time ) {
+  HANDLE handle = (HANDLE)_get_osfhandle( _fileno( file ) );
+  if( handle == INVALID_HANDLE_VALUE )
+    return false;
+
+  // The buffered writes are counted in the size
+  fflush( file );
+  LARGE_INTEGER fileSize;
+  FILETIME fileTime;
+  if( !GetFileSizeEx( handle, &fileSize ) || !GetFileTime( handle, Null, Null, &fileTime ) )
+    return false;
+
+  size = fileSize.QuadPart;
+  time = ((ULONGLONG)fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime;
+  return true;
+}
+
+bool ZippedIndex::Load( const char* fileName, const ZippedIndexHeader& header, ulong* offsets, ulong* positions, ulong* lengths ) {
+  FILE* file = fopen( fileName, "rb" );
+  if( !file )
+    return false;
+
+  ZippedIndexHeader stored;
+  memset( &stored, 0, sizeof( stored ) );
+  bool valid =
+    fread( &stored, 1, sizeof( stored ), file ) == sizeof( stored ) &&
+    stored.Signature    == ZippedIndexSignature &&
+    stored.Size         == sizeof( stored )     &&
+    stored.FileSize     == header.FileSize      &&
+    stored.FileTime     == header.FileTime      &&
+    stored.BasePosition == header.BasePosition  &&
+    stored.StreamHash   == header.StreamHash    &&
+    stored.BlocksCount  == header.BlocksCount;
+
+  // The table is read into the temporary arrays,
+  // so a broken file does not change the stream
+  uint count = header.BlocksCount;
+  ulong* table = valid ? new ulong[count * 3 + 2] : Null;
+  if( valid )
+    valid = fread( table, sizeof( ulong ), count * 3 + 2, file ) == count * 3 + 2;
+
+  fclose( file );
+  if( valid ) {
+    memcpy( offsets,   table,                 sizeof( ulong ) * (count + 1) );
+    memcpy( positions, table + count + 1,     sizeof( ulong ) * (count + 1) );
+    memcpy( lengths,   table + count * 2 + 2, sizeof( ulong ) * count );
+  }
+
+  delete[] table;
+  return valid;
+}
+
+bool ZippedIndex::Save( const char* fileName, const ZippedIndexHeader& header, const ulong* offsets, const ulong* positions, const ulong* lengths ) {
+  FILE* file = fopen( fileName, "wb" );
+  if( !file )
+    return false;
+
+  uint count = header.BlocksCount;
+  ZippedIndexHeader stored = header;
+  stored.Signature = ZippedIndexSignature;
+  stored.Size      = sizeof( stored );
+  bool writed =
+    fwrite( &stored,   sizeof( stored ), 1, file )        == 1         &&
+    fwrite( offsets,   sizeof( ulong ), count + 1, file ) == count + 1 &&
+    fwrite( positions, sizeof( ulong ), count + 1, file ) == count + 1 &&
+    fwrite( lengths,   sizeof( ulong ), count, file )     == count;
+
+  // A partial index is removed, so it is never loaded
+  writed = fclose( file ) == 0 && writed;
+  if( !writed )
+    remove( fileName );
+
+  return writed;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+
+
+const ulong ZippedIndexSignature = 0x5849535A; // ZSIX
+
+// Header of the sidecar index file (.zsidx). The index is valid
+// while the size, the write time and the header of the stream
+// file are the same as when the index was written.
+struct ZippedIndexHeader {
+  ulong Signature;
+  ulong Size;            // Size of this structure in the file
+  ULONGLONG FileSize;
+  ULONGLONG FileTime;
+  ulong BasePosition;
+  ZippedHash StreamHash; // Stream header, extension and dictionary
+  uint BlocksCount;
+};
+
+// Block table of a stream stored in a separate file. The table
+// follows the header: the uncompressed starts and the header
+// positions of the blocks and the stream end, then the compressed
+// lengths of the blocks.
+class ZSTREAMAPI ZippedIndex {
+public:
+  static bool GetFileStamp( FILE* file, ULONGLONG& size, ULONGLONG& time );
+  static bool Load( const char* fileName, const ZippedIndexHeader& header, ulong* offsets, ulong* positions, ulong* lengths );
+  static bool Save( const char* fileName, const ZippedIndexHeader& header, const ulong* offsets, const ulong* positions, const ulong* lengths );
+};
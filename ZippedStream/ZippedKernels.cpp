@@ -0,0 +1,521 @@
+#include "ZippedAfx.h"
+#include <intrin.h>
+#include <immintrin.h>
+#if defined( _M_X64 ) || _M_IX86_FP >= 2 || defined( __SSE2__ )
+#define ZIPPED_KERNELS_SSE2
+#endif
+
+enum {
+  SIMD_NONE,
+  SIMD_SSSE3,
+  SIMD_AVX2
+};
+
+static int DetectSimdLevel() {
+  int info[4];
+  __cpuid( info, 0 );
+  int leavesCount = info[0];
+
+  __cpuid( info, 1 );
+  bool ssse3   = (info[2] & (1 << 9))  != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx     = (info[2] & (1 << 28)) != 0;
+
+  // AVX2 also needs the OS to save the YMM registers
+  if( leavesCount >= 7 && osxsave && avx && (_xgetbv( 0 ) & 6) == 6 ) {
+    __cpuidex( info, 7, 0 );
+    if( info[1] & (1 << 5) )
+      return SIMD_AVX2;
+  }
+
+  return ssse3 ? SIMD_SSSE3 : SIMD_NONE;
+}
+
+static int GetSimdLevel() {
+  static int level = DetectSimdLevel();
+  return level;
+}
+
+
+
+bool ZippedKernels::IsFilled( const byte* buffer, const ulong& length, const byte& value ) {
+  ulong i = 0;
+#ifdef ZIPPED_KERNELS_SSE2
+  const __m128i pattern = _mm_set1_epi8( (char)value );
+  for( ; i + 64 <= length; i += 64 ) {
+    __m128i diff0 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(buffer + i) ),      pattern );
+    __m128i diff1 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(buffer + i + 16) ), pattern );
+    __m128i diff2 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(buffer + i + 32) ), pattern );
+    __m128i diff3 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(buffer + i + 48) ), pattern );
+    __m128i diff  = _mm_or_si128( _mm_or_si128( diff0, diff1 ), _mm_or_si128( diff2, diff3 ) );
+    if( _mm_movemask_epi8( _mm_cmpeq_epi8( diff, _mm_setzero_si128() ) ) != 0xFFFF )
+      return false;
+  }
+#endif
+
+  for( ; i < length; i++ )
+    if( buffer[i] != value )
+      return false;
+
+  return true;
+}
+
+
+
+#pragma region shuffle
+// The byte shuffle kernels work with 16 elements per lane. Every
+// vector is sorted by pshufb so each byte plane takes a contiguous
+// chunk, then the chunk matrix of the vectors is transposed.
+static __m128i GetShuffleMask( const uint& elementSize, const bool& inverse ) {
+  byte mask[16];
+  uint elementsCount = 16 / elementSize;
+  for( uint plane = 0; plane < elementSize; plane++ ) {
+    for( uint element = 0; element < elementsCount; element++ ) {
+      uint grouped     = plane * elementsCount + element;
+      uint interleaved = element * elementSize + plane;
+      if( inverse )
+        mask[interleaved] = grouped;
+      else
+        mask[grouped] = interleaved;
+    }
+  }
+
+  return _mm_loadu_si128( (const __m128i*)mask );
+}
+
+static inline void Transpose2x64( __m128i* v ) {
+  __m128i t0 = _mm_unpacklo_epi64( v[0], v[1] );
+  __m128i t1 = _mm_unpackhi_epi64( v[0], v[1] );
+  v[0] = t0;
+  v[1] = t1;
+}
+
+static inline void Transpose4x32( __m128i* v ) {
+  __m128i t0 = _mm_unpacklo_epi32( v[0], v[1] );
+  __m128i t1 = _mm_unpacklo_epi32( v[2], v[3] );
+  __m128i t2 = _mm_unpackhi_epi32( v[0], v[1] );
+  __m128i t3 = _mm_unpackhi_epi32( v[2], v[3] );
+  v[0] = _mm_unpacklo_epi64( t0, t1 );
+  v[1] = _mm_unpackhi_epi64( t0, t1 );
+  v[2] = _mm_unpacklo_epi64( t2, t3 );
+  v[3] = _mm_unpackhi_epi64( t2, t3 );
+}
+
+static inline void Transpose8x16( __m128i* v ) {
+  __m128i a[8];
+  __m128i b[8];
+  for( uint i = 0; i < 4; i++ ) {
+    a[i]     = _mm_unpacklo_epi16( v[i * 2], v[i * 2 + 1] );
+    a[i + 4] = _mm_unpackhi_epi16( v[i * 2], v[i * 2 + 1] );
+  }
+
+  for( uint i = 0; i < 2; i++ ) {
+    b[i * 4]     = _mm_unpacklo_epi32( a[i * 4],     a[i * 4 + 1] );
+    b[i * 4 + 1] = _mm_unpacklo_epi32( a[i * 4 + 2], a[i * 4 + 3] );
+    b[i * 4 + 2] = _mm_unpackhi_epi32( a[i * 4],     a[i * 4 + 1] );
+    b[i * 4 + 3] = _mm_unpackhi_epi32( a[i * 4 + 2], a[i * 4 + 3] );
+  }
+
+  for( uint i = 0; i < 4; i++ ) {
+    v[i * 2]     = _mm_unpacklo_epi64( b[i * 2], b[i * 2 + 1] );
+    v[i * 2 + 1] = _mm_unpackhi_epi64( b[i * 2], b[i * 2 + 1] );
+  }
+}
+
+static inline void TransposeChunks( __m128i* v, const uint& elementSize ) {
+  switch( elementSize ) {
+    case 2: Transpose2x64( v ); break;
+    case 4: Transpose4x32( v ); break;
+    case 8: Transpose8x16( v ); break;
+  }
+}
+
+static inline void Transpose2x64( __m256i* v ) {
+  __m256i t0 = _mm256_unpacklo_epi64( v[0], v[1] );
+  __m256i t1 = _mm256_unpackhi_epi64( v[0], v[1] );
+  v[0] = t0;
+  v[1] = t1;
+}
+
+static inline void Transpose4x32( __m256i* v ) {
+  __m256i t0 = _mm256_unpacklo_epi32( v[0], v[1] );
+  __m256i t1 = _mm256_unpacklo_epi32( v[2], v[3] );
+  __m256i t2 = _mm256_unpackhi_epi32( v[0], v[1] );
+  __m256i t3 = _mm256_unpackhi_epi32( v[2], v[3] );
+  v[0] = _mm256_unpacklo_epi64( t0, t1 );
+  v[1] = _mm256_unpackhi_epi64( t0, t1 );
+  v[2] = _mm256_unpacklo_epi64( t2, t3 );
+  v[3] = _mm256_unpackhi_epi64( t2, t3 );
+}
+
+static inline void Transpose8x16( __m256i* v ) {
+  __m256i a[8];
+  __m256i b[8];
+  for( uint i = 0; i < 4; i++ ) {
+    a[i]     = _mm256_unpacklo_epi16( v[i * 2], v[i * 2 + 1] );
+    a[i + 4] = _mm256_unpackhi_epi16( v[i * 2], v[i * 2 + 1] );
+  }
+
+  for( uint i = 0; i < 2; i++ ) {
+    b[i * 4]     = _mm256_unpacklo_epi32( a[i * 4],     a[i * 4 + 1] );
+    b[i * 4 + 1] = _mm256_unpacklo_epi32( a[i * 4 + 2], a[i * 4 + 3] );
+    b[i * 4 + 2] = _mm256_unpackhi_epi32( a[i * 4],     a[i * 4 + 1] );
+    b[i * 4 + 3] = _mm256_unpackhi_epi32( a[i * 4 + 2], a[i * 4 + 3] );
+  }
+
+  for( uint i = 0; i < 4; i++ ) {
+    v[i * 2]     = _mm256_unpacklo_epi64( b[i * 2], b[i * 2 + 1] );
+    v[i * 2 + 1] = _mm256_unpackhi_epi64( b[i * 2], b[i * 2 + 1] );
+  }
+}
+
+static inline void TransposeChunks( __m256i* v, const uint& elementSize ) {
+  switch( elementSize ) {
+    case 2: Transpose2x64( v ); break;
+    case 4: Transpose4x32( v ); break;
+    case 8: Transpose8x16( v ); break;
+  }
+}
+
+// Start from the element i and return the first unprocessed element
+static ulong ShuffleSsse3( const byte* source, byte* destination, const ulong& count, const uint& elementSize, ulong i ) {
+  const __m128i mask = GetShuffleMask( elementSize, false );
+  __m128i v[8];
+  for( ; i + 16 <= count; i += 16 ) {
+    for( uint k = 0; k < elementSize; k++ )
+      v[k] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(source + i * elementSize + k * 16) ), mask );
+
+    TransposeChunks( v, elementSize );
+    for( uint k = 0; k < elementSize; k++ )
+      _mm_storeu_si128( (__m128i*)(destination + k * count + i), v[k] );
+  }
+
+  return i;
+}
+
+static ulong UnshuffleSsse3( const byte* source, byte* destination, const ulong& count, const uint& elementSize, ulong i ) {
+  const __m128i mask = GetShuffleMask( elementSize, true );
+  __m128i v[8];
+  for( ; i + 16 <= count; i += 16 ) {
+    for( uint k = 0; k < elementSize; k++ )
+      v[k] = _mm_loadu_si128( (const __m128i*)(source + k * count + i) );
+
+    TransposeChunks( v, elementSize );
+    for( uint k = 0; k < elementSize; k++ )
+      _mm_storeu_si128( (__m128i*)(destination + i * elementSize + k * 16), _mm_shuffle_epi8( v[k], mask ) );
+  }
+
+  return i;
+}
+
+// The low lane takes 16 elements and the high lane takes the next 16,
+// so after the transposition every vector is 32 bytes of one plane
+static ulong ShuffleAvx2( const byte* source, byte* destination, const ulong& count, const uint& elementSize, ulong i ) {
+  const __m128i mask128 = GetShuffleMask( elementSize, false );
+  const __m256i mask = _mm256_inserti128_si256( _mm256_castsi128_si256( mask128 ), mask128, 1 );
+  __m256i v[8];
+  for( ; i + 32 <= count; i += 32 ) {
+    for( uint k = 0; k < elementSize; k++ ) {
+      __m128i low  = _mm_loadu_si128( (const __m128i*)(source + i * elementSize + k * 16) );
+      __m128i high = _mm_loadu_si128( (const __m128i*)(source + (i + 16) * elementSize + k * 16) );
+      __m256i data = _mm256_inserti128_si256( _mm256_castsi128_si256( low ), high, 1 );
+      v[k] = _mm256_shuffle_epi8( data, mask );
+    }
+
+    TransposeChunks( v, elementSize );
+    for( uint k = 0; k < elementSize; k++ )
+      _mm256_storeu_si256( (__m256i*)(destination + k * count + i), v[k] );
+  }
+
+  return i;
+}
+
+static ulong UnshuffleAvx2( const byte* source, byte* destination, const ulong& count, const uint& elementSize, ulong i ) {
+  const __m128i mask128 = GetShuffleMask( elementSize, true );
+  const __m256i mask = _mm256_inserti128_si256( _mm256_castsi128_si256( mask128 ), mask128, 1 );
+  __m256i v[8];
+  for( ; i + 32 <= count; i += 32 ) {
+    for( uint k = 0; k < elementSize; k++ )
+      v[k] = _mm256_loadu_si256( (const __m256i*)(source + k * count + i) );
+
+    TransposeChunks( v, elementSize );
+    for( uint k = 0; k < elementSize; k++ ) {
+      __m256i data = _mm256_shuffle_epi8( v[k], mask );
+      _mm_storeu_si128( (__m128i*)(destination + i * elementSize + k * 16), _mm256_castsi256_si128( data ) );
+      _mm_storeu_si128( (__m128i*)(destination + (i + 16) * elementSize + k * 16), _mm256_extracti128_si256( data, 1 ) );
+    }
+  }
+
+  return i;
+}
+
+static bool HasShuffleKernel( const uint& elementSize ) {
+  return elementSize == 2 || elementSize == 4 || elementSize == 8;
+}
+
+void ZippedKernels::Shuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize ) {
+  ulong count = length / elementSize;
+  ulong i = 0;
+  if( HasShuffleKernel( elementSize ) ) {
+    int level = GetSimdLevel();
+    if( level >= SIMD_AVX2 )
+      i = ShuffleAvx2( source, destination, count, elementSize, i );
+    if( level >= SIMD_SSSE3 )
+      i = ShuffleSsse3( source, destination, count, elementSize, i );
+  }
+
+  for( uint plane = 0; plane < elementSize; plane++ )
+    for( ulong element = i; element < count; element++ )
+      destination[plane * count + element] = source[element * elementSize + plane];
+
+  ulong shuffled = count * elementSize;
+  memcpy( destination + shuffled, source + shuffled, length - shuffled );
+}
+
+void ZippedKernels::Unshuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize ) {
+  ulong count = length / elementSize;
+  ulong i = 0;
+  if( HasShuffleKernel( elementSize ) ) {
+    int level = GetSimdLevel();
+    if( level >= SIMD_AVX2 )
+      i = UnshuffleAvx2( source, destination, count, elementSize, i );
+    if( level >= SIMD_SSSE3 )
+      i = UnshuffleSsse3( source, destination, count, elementSize, i );
+  }
+
+  for( uint plane = 0; plane < elementSize; plane++ )
+    for( ulong element = i; element < count; element++ )
+      destination[element * elementSize + plane] = source[plane * count + element];
+
+  ulong shuffled = count * elementSize;
+  memcpy( destination + shuffled, source + shuffled, length - shuffled );
+}
+#pragma endregion
+
+
+
+#pragma region bitshuffle
+// Transposes the 8x8 bit matrix of the 8 bytes. The
+// transposition is its own inverse (Hacker's Delight 7-3).
+static inline ULONGLONG TransposeBits8x8( ULONGLONG x ) {
+  ULONGLONG t;
+  t = (x ^ (x >> 7))  & 0x00AA00AA00AA00AAULL; x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL; x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL; x = x ^ t ^ (t << 28);
+  return x;
+}
+
+// Splits every byte plane into 8 bit planes. Bit k of the output byte g
+// in the bit plane b is the bit b of the plane byte 8 * g + k.
+static void BitTransposePlane( const byte* plane, byte* destination, const ulong& count ) {
+  ulong groupsCount = count / 8;
+  ulong i = 0;
+  if( GetSimdLevel() >= SIMD_AVX2 ) {
+    for( ; i + 32 <= count; i += 32 ) {
+      __m256i data = _mm256_loadu_si256( (const __m256i*)(plane + i) );
+      for( int bit = 7; bit >= 0; bit-- ) {
+        uint mask = (uint)_mm256_movemask_epi8( data );
+        memcpy( destination + bit * groupsCount + i / 8, &mask, 4 );
+        data = _mm256_slli_epi16( data, 1 );
+      }
+    }
+  }
+
+#ifdef ZIPPED_KERNELS_SSE2
+  for( ; i + 16 <= count; i += 16 ) {
+    __m128i data = _mm_loadu_si128( (const __m128i*)(plane + i) );
+    for( int bit = 7; bit >= 0; bit-- ) {
+      uint mask = (uint)_mm_movemask_epi8( data );
+      memcpy( destination + bit * groupsCount + i / 8, &mask, 2 );
+      data = _mm_slli_epi16( data, 1 );
+    }
+  }
+#endif
+
+  for( ; i < count; i += 8 ) {
+    ULONGLONG bits;
+    memcpy( &bits, plane + i, 8 );
+    bits = TransposeBits8x8( bits );
+    for( uint bit = 0; bit < 8; bit++ )
+      destination[bit * groupsCount + i / 8] = (byte)(bits >> (bit * 8));
+  }
+}
+
+static void BitUntransposePlane( const byte* source, byte* plane, const ulong& count ) {
+  ulong groupsCount = count / 8;
+  for( ulong i = 0; i < count; i += 8 ) {
+    ULONGLONG bits = 0;
+    for( uint bit = 0; bit < 8; bit++ )
+      bits |= (ULONGLONG)source[bit * groupsCount + i / 8] << (bit * 8);
+
+    bits = TransposeBits8x8( bits );
+    memcpy( plane + i, &bits, 8 );
+  }
+}
+
+void ZippedKernels::BitShuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize ) {
+  // Only groups of 8 elements are transposed, the rest is copied
+  ulong count = (length / elementSize) & ~7ul;
+  ulong shuffled = count * elementSize;
+  if( count > 0 ) {
+    byte* planes = new byte[shuffled];
+    Shuffle( source, planes, shuffled, elementSize );
+    for( uint plane = 0; plane < elementSize; plane++ )
+      BitTransposePlane( planes + plane * count, destination + plane * count, count );
+
+    delete[] planes;
+  }
+
+  memcpy( destination + shuffled, source + shuffled, length - shuffled );
+}
+
+void ZippedKernels::BitUnshuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize ) {
+  ulong count = (length / elementSize) & ~7ul;
+  ulong shuffled = count * elementSize;
+  if( count > 0 ) {
+    byte* planes = new byte[shuffled];
+    for( uint plane = 0; plane < elementSize; plane++ )
+      BitUntransposePlane( source + plane * count, planes + plane * count, count );
+
+    Unshuffle( planes, destination, shuffled, elementSize );
+    delete[] planes;
+  }
+
+  memcpy( destination + shuffled, source + shuffled, length - shuffled );
+}
+#pragma endregion
+
+
+
+#pragma region delta
+void ZippedKernels::DeltaEncode( byte* buffer, const ulong& length, const uint& stride ) {
+  if( length <= stride )
+    return;
+
+  // Goes from the end, so every byte is
+  // subtracted before it is changed itself
+  ulong i = length;
+  if( GetSimdLevel() >= SIMD_AVX2 ) {
+    for( ; i >= stride + 32; i -= 32 ) {
+      __m256i current  = _mm256_loadu_si256( (const __m256i*)(buffer + i - 32) );
+      __m256i previous = _mm256_loadu_si256( (const __m256i*)(buffer + i - 32 - stride) );
+      _mm256_storeu_si256( (__m256i*)(buffer + i - 32), _mm256_sub_epi8( current, previous ) );
+    }
+  }
+
+#ifdef ZIPPED_KERNELS_SSE2
+  for( ; i >= stride + 16; i -= 16 ) {
+    __m128i current  = _mm_loadu_si128( (const __m128i*)(buffer + i - 16) );
+    __m128i previous = _mm_loadu_si128( (const __m128i*)(buffer + i - 16 - stride) );
+    _mm_storeu_si128( (__m128i*)(buffer + i - 16), _mm_sub_epi8( current, previous ) );
+  }
+#endif
+
+  for( ; i > stride; i-- )
+    buffer[i - 1] -= buffer[i - 1 - stride];
+}
+
+#ifdef ZIPPED_KERNELS_SSE2
+// Prefix sum of the vector with the given stride
+static inline __m128i PrefixSum( __m128i data, const uint& stride ) {
+  switch( stride ) {
+    case 1: data = _mm_add_epi8( data, _mm_slli_si128( data, 1 ) );
+    case 2: data = _mm_add_epi8( data, _mm_slli_si128( data, 2 ) );
+    case 4: data = _mm_add_epi8( data, _mm_slli_si128( data, 4 ) );
+    case 8: data = _mm_add_epi8( data, _mm_slli_si128( data, 8 ) );
+  }
+
+  return data;
+}
+
+// Repeats the last stride bytes of the vector over the whole vector
+static inline __m128i BroadcastTail( const __m128i& data, const uint& stride ) {
+  switch( stride ) {
+    case 1: {
+      __m128i words = _mm_unpackhi_epi8( data, data );
+      words = _mm_shufflehi_epi16( words, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+      return _mm_unpackhi_epi64( words, words );
+    }
+    case 2: {
+      __m128i words = _mm_shufflehi_epi16( data, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+      return _mm_unpackhi_epi64( words, words );
+    }
+    case 4: return _mm_shuffle_epi32( data, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    case 8: return _mm_unpackhi_epi64( data, data );
+  }
+
+  return data;
+}
+#endif
+
+void ZippedKernels::DeltaDecode( byte* buffer, const ulong& length, const uint& stride ) {
+  ulong i = 0;
+#ifdef ZIPPED_KERNELS_SSE2
+  if( stride >= 16 ) {
+    // Every vector depends only on the already decoded bytes
+    for( i = stride; i + 16 <= length; i += 16 ) {
+      __m128i current  = _mm_loadu_si128( (const __m128i*)(buffer + i) );
+      __m128i previous = _mm_loadu_si128( (const __m128i*)(buffer + i - stride) );
+      _mm_storeu_si128( (__m128i*)(buffer + i), _mm_add_epi8( current, previous ) );
+    }
+  }
+  else if( 16 % stride == 0 ) {
+    __m128i carry = _mm_setzero_si128();
+    for( ; i + 16 <= length; i += 16 ) {
+      __m128i data = PrefixSum( _mm_loadu_si128( (const __m128i*)(buffer + i) ), stride );
+      data = _mm_add_epi8( data, carry );
+      _mm_storeu_si128( (__m128i*)(buffer + i), data );
+      carry = BroadcastTail( data, stride );
+    }
+  }
+#endif
+
+  for( i = max( i, (ulong)stride ); i < length; i++ )
+    buffer[i] += buffer[i - stride];
+}
+#pragma endregion
+
+
+
+#pragma region filters
+ulong ZippedKernels::MakeFilter( const ulong& filter, const uint& elementSize ) {
+  ZIPASSERT( elementSize > 0 && elementSize < 256, "Bad zipped filter element size." );
+  return (filter & ZIPPED_FILTER_MASK) | (elementSize << 8);
+}
+
+static uint GetDeltaStride( const ulong& filter ) {
+  // After a shuffle the same bytes of the near elements are neighbours
+  if( filter & (ZIPPED_FILTER_SHUFFLE | ZIPPED_FILTER_BITSHUFFLE) )
+    return 1;
+
+  return (filter >> 8) & 0xFF;
+}
+
+void ZippedKernels::ApplyFilter( const ulong& filter, const byte* source, byte* destination, const ulong& length ) {
+  uint elementSize = (filter >> 8) & 0xFF;
+  if( filter & ZIPPED_FILTER_SHUFFLE )
+    Shuffle( source, destination, length, elementSize );
+  else if( filter & ZIPPED_FILTER_BITSHUFFLE )
+    BitShuffle( source, destination, length, elementSize );
+  else
+    memcpy( destination, source, length );
+
+  if( filter & ZIPPED_FILTER_DELTA )
+    DeltaEncode( destination, length, GetDeltaStride( filter ) );
+}
+
+bool ZippedKernels::RemoveFilter( const ulong& filter, byte* source, byte* destination, const ulong& length ) {
+  uint elementSize = (filter >> 8) & 0xFF;
+  if( filter & ZIPPED_FILTER_DELTA )
+    DeltaDecode( source, length, GetDeltaStride( filter ) );
+
+  if( filter & ZIPPED_FILTER_SHUFFLE )
+    Unshuffle( source, destination, length, elementSize );
+  else if( filter & ZIPPED_FILTER_BITSHUFFLE )
+    BitUnshuffle( source, destination, length, elementSize );
+  else
+    return false;
+
+  return true;
+}
+#pragma endregion
@@ -0,0 +1,27 @@
+#pragma once
+
+
+
+enum {
+  ZIPPED_FILTER_SHUFFLE    = 1 << 0, // Groups the same bytes of the elements
+  ZIPPED_FILTER_BITSHUFFLE = 1 << 1, // Groups the same bits of the elements
+  ZIPPED_FILTER_DELTA      = 1 << 2, // Stores the difference with the previous element
+  ZIPPED_FILTER_MASK       = 0xFF    // Element size is stored in the next byte
+};
+
+
+
+// Vectorized helpers for the block data. The kernels
+// choose between AVX2, SSSE3 and SSE2 at runtime.
+struct ZSTREAMAPI ZippedKernels {
+  static bool IsFilled( const byte* buffer, const ulong& length, const byte& value );
+  static void Shuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize );
+  static void Unshuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize );
+  static void BitShuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize );
+  static void BitUnshuffle( const byte* source, byte* destination, const ulong& length, const uint& elementSize );
+  static void DeltaEncode( byte* buffer, const ulong& length, const uint& stride );
+  static void DeltaDecode( byte* buffer, const ulong& length, const uint& stride );
+  static ulong MakeFilter( const ulong& filter, const uint& elementSize );
+  static void ApplyFilter( const ulong& filter, const byte* source, byte* destination, const ulong& length );
+  static bool RemoveFilter( const ulong& filter, byte* source, byte* destination, const ulong& length );
+};
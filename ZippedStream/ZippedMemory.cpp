@@ -0,0 +1,99 @@
+#include "ZippedAfx.h"
+
+ZippedMemory::ZippedMemory() {
+  Buffer   = Null;
+  Length   = 0;
+  Capacity = 0;
+  Owned    = true;
+}
+
+ZippedMemory::ZippedMemory( const byte* buffer, const ulong& length ) {
+  Buffer   = (byte*)buffer;
+  Length   = length;
+  Capacity = length;
+  Owned    = false;
+}
+
+byte* ZippedMemory::GetBuffer() {
+  return Buffer;
+}
+
+ulong ZippedMemory::GetLength() {
+  return Length;
+}
+
+bool ZippedMemory::IsReadOnly() {
+  return !Owned;
+}
+
+void ZippedMemory::Reserve( const ulong& capacity ) {
+  ZIPASSERT( Owned, "Can not resize the external zipped memory." );
+  if( capacity <= Capacity )
+    return;
+
+  Buffer = (byte*)shi_realloc( Buffer, capacity );
+  ZIPASSERT( Buffer != Null, "Can not alloc buffer. Out of memory." );
+  Capacity = capacity;
+}
+
+ulong ZippedMemory::Read( void* buffer, const ulong& position, const ulong& length ) {
+  if( position >= Length )
+    return 0;
+
+  ulong toRead = min( length, Length - position );
+  memcpy( buffer, Buffer + position, toRead );
+  return toRead;
+}
+
+ulong ZippedMemory::Write( const void* buffer, const ulong& position, const ulong& length ) {
+  ZIPASSERT( Owned, "Can not write into the external zipped memory." );
+
+  // The arena grows twice, so the appends take amortized constant time
+  ulong end = position + length;
+  if( end > Capacity )
+    Reserve( max( end, Capacity * 2 ) );
+
+  // Like a file, the gap after the end is zeroed
+  if( position > Length )
+    memset( Buffer + Length, 0, position - Length );
+
+  memcpy( Buffer + position, buffer, length );
+  Length = max( Length, end );
+  return length;
+}
+
+void ZippedMemory::Clear() {
+  if( Owned )
+    shi_free( Buffer );
+
+  Buffer   = Null;
+  Length   = 0;
+  Capacity = 0;
+  Owned    = true;
+}
+
+ZippedMemory::~ZippedMemory() {
+  Clear();
+}
+
+ulong ZippedMemory::ReadAt( FILE* file, ZippedMemory* memory, void* buffer, const ulong& position, const ulong& length ) {
+  if( memory )
+    return memory->Read( buffer, position, length );
+
+  long returnPosition = ftell( file );
+  fseek( file, position, SEEK_SET );
+  ulong readed = fread( buffer, 1, length, file );
+  fseek( file, returnPosition, SEEK_SET );
+  return readed;
+}
+
+ulong ZippedMemory::WriteAt( FILE* file, ZippedMemory* memory, const void* buffer, const ulong& position, const ulong& length ) {
+  if( memory )
+    return memory->Write( buffer, position, length );
+
+  long returnPosition = ftell( file );
+  fseek( file, position, SEEK_SET );
+  ulong written = fwrite( buffer, 1, length, file );
+  fseek( file, returnPosition, SEEK_SET );
+  return written;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+
+
+// Memory which holds a zipped stream instead of a file. The writer
+// appends to a growable arena, the reader inflates the blocks
+// straight from the memory. A memory created from an external
+// buffer is read-only and the buffer is not copied.
+class ZSTREAMAPI ZippedMemory {
+  byte* Buffer;
+  ulong Length;
+  ulong Capacity;
+  bool Owned;
+
+public:
+  ZippedMemory();
+  ZippedMemory( const byte* buffer, const ulong& length );
+  byte* GetBuffer();
+  ulong GetLength();
+  bool IsReadOnly();
+  void Reserve( const ulong& capacity );
+  ulong Read( void* buffer, const ulong& position, const ulong& length );
+  ulong Write( const void* buffer, const ulong& position, const ulong& length );
+  void Clear();
+  ~ZippedMemory();
+
+  // Positional access of the base stream, the memory is used when it is
+  // not Null. The position of the file is restored after the access.
+  static ulong ReadAt( FILE* file, ZippedMemory* memory, void* buffer, const ulong& position, const ulong& length );
+  static ulong WriteAt( FILE* file, ZippedMemory* memory, const void* buffer, const ulong& position, const ulong& length );
+};
@@ -0,0 +1,179 @@
+#include "ZippedAfx.h"
+
+struct ZippedParallelContext {
+  ZippedParallelProc Procedure;
+  void* Context;
+  uint Count;
+  volatile long Iterator;
+  volatile long Finished;   // Indices which are run or skipped
+  volatile long References; // The caller and the posted workers
+  volatile long Failed;
+  HANDLE FinishEvent;
+  char Message[256];
+  Common::ThreadLocker MessageMutex;
+};
+
+static void ReleaseContext( ZippedParallelContext* context ) {
+  // The workers posted to a finished loop free it by the last reference
+  if( InterlockedDecrement( &context->References ) == 0 ) {
+    CloseHandle( context->FinishEvent );
+    delete context;
+  }
+}
+
+static void ParallelProcedure( ZippedParallelContext& context ) {
+  while( true ) {
+    long index = InterlockedIncrement( &context.Iterator ) - 1;
+    if( index >= (long)context.Count )
+      break;
+
+    // After a failure the rest of the indices are only counted
+    if( !context.Failed ) {
+      try {
+        context.Procedure( context.Context, index );
+      }
+      catch( std::exception& exception ) {
+        context.MessageMutex.Enter();
+        if( !context.Failed ) {
+          ulong length = min( (ulong)strlen( exception.what() ), (ulong)sizeof( context.Message ) - 1 );
+          memcpy( context.Message, exception.what(), length );
+          context.Failed = True;
+        }
+        context.MessageMutex.Leave();
+      }
+    }
+
+    if( InterlockedIncrement( &context.Finished ) == (long)context.Count )
+      SetEvent( context.FinishEvent );
+  }
+}
+
+// Persistent workers of the loops. A loop is posted to the port
+// once for every helper, the worker which gets it joins the loop.
+// The workers are created by the first loops which need them.
+struct ZippedParallelPool {
+  HANDLE Port;
+  uint ThreadsCount;
+  Common::ThreadLocker Mutex;
+
+  ZippedParallelPool() {
+    Port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, Null, 0, 0 );
+    ZIPASSERT( Port != Null, "Can not create a zipped parallel port." );
+    ThreadsCount = 0;
+  }
+
+  static ulong WINAPI WorkerThread( void* argument ) {
+    ZippedParallelPool* pool = (ZippedParallelPool*)argument;
+    while( true ) {
+      DWORD length = 0;
+      ULONG_PTR key = 0;
+      OVERLAPPED* overlapped = Null;
+      GetQueuedCompletionStatus( pool->Port, &length, &key, &overlapped, INFINITE );
+      auto context = (ZippedParallelContext*)key;
+      if( context == Null )
+        break;
+
+      ParallelProcedure( *context );
+      ReleaseContext( context );
+    }
+
+    return 0;
+  }
+
+  void Reserve( const uint& threadsCount ) {
+    Mutex.Enter();
+    while( ThreadsCount < threadsCount ) {
+      Common::Thread thread;
+      thread.Init( &WorkerThread );
+      thread.Detach( this );
+      CloseHandle( thread.GetHandle() );
+      ThreadsCount++;
+    }
+    Mutex.Leave();
+  }
+
+  void Post( ZippedParallelContext* context, const uint& helpersCount ) {
+    Reserve( helpersCount );
+    for( uint i = 0; i < helpersCount; i++ ) {
+      InterlockedIncrement( &context->References );
+      PostQueuedCompletionStatus( Port, 0, (ULONG_PTR)context, Null );
+    }
+  }
+
+  static ZippedParallelPool& GetInstance() {
+    static ZippedParallelPool* pool = new ZippedParallelPool();
+    return *pool;
+  }
+};
+
+uint ZippedParallel::GetThreadsCount() {
+  if( PARALLEL_THREADS_COUNT > 0 )
+    return PARALLEL_THREADS_COUNT;
+
+  SYSTEM_INFO info;
+  GetSystemInfo( &info );
+  return max( 1ul, (ulong)info.dwNumberOfProcessors );
+}
+
+static ZippedParallelContext* StartLoop( const uint& count, ZippedParallelProc procedure, void* context, const uint& helpersCount ) {
+  // The context lives on the heap, so the workers which get
+  // the loop after its end do not touch the caller's stack
+  ZippedParallelContext* loop = new ZippedParallelContext();
+  loop->Procedure   = procedure;
+  loop->Context     = context;
+  loop->Count       = count;
+  loop->Iterator    = 0;
+  loop->Finished    = 0;
+  loop->References  = 1;
+  loop->Failed      = False;
+  loop->FinishEvent = CreateEvent( Null, True, False, Null );
+  memset( loop->Message, 0, sizeof( loop->Message ) );
+  ZippedParallelPool::GetInstance().Post( loop, helpersCount );
+  return loop;
+}
+
+void ZippedParallel::For( const uint& count, ZippedParallelProc procedure, void* context, uint threadsCount ) {
+  if( count == 0 )
+    return;
+
+  if( threadsCount == 0 )
+    threadsCount = GetThreadsCount();
+
+  // The single task and the single thread loops run inline
+  threadsCount = min( threadsCount, count );
+  if( threadsCount == 1 ) {
+    for( uint i = 0; i < count; i++ )
+      procedure( context, i );
+
+    return;
+  }
+
+  // The calling thread is the last worker
+  End( StartLoop( count, procedure, context, threadsCount - 1 ) );
+}
+
+ZippedParallelContext* ZippedParallel::Begin( const uint& count, ZippedParallelProc procedure, void* context, uint threadsCount ) {
+  if( count == 0 )
+    return Null;
+
+  if( threadsCount == 0 )
+    threadsCount = GetThreadsCount();
+
+  return StartLoop( count, procedure, context, min( threadsCount, count ) );
+}
+
+void ZippedParallel::End( ZippedParallelContext* loop ) {
+  if( !loop )
+    return;
+
+  // The caller takes the tasks left, so the nested
+  // loops go on when all of the pool workers are busy
+  ParallelProcedure( *loop );
+  WaitForSingleObject( loop->FinishEvent, INFINITE );
+
+  bool failed = loop->Failed != False;
+  char message[sizeof( loop->Message )];
+  memcpy( message, loop->Message, sizeof( message ) );
+  ReleaseContext( loop );
+  ZIPASSERT( !failed, message );
+}
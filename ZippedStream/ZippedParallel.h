@@ -0,0 +1,21 @@
+#pragma once
+
+
+
+typedef void( *ZippedParallelProc )( void* context, const uint& index );
+
+struct ZippedParallelContext;
+
+// Runs the procedure for every index from 0 to count on the worker
+// threads. Workers take the next index by themselves, so long and
+// short tasks are balanced. The workers are persistent and shared
+// by all loops, the calling thread works too. An exception of any
+// task is thrown again in the calling thread after all tasks end.
+// A loop started by Begin runs while the caller does other work,
+// End joins the loop and waits for it.
+struct ZSTREAMAPI ZippedParallel {
+  static uint GetThreadsCount();
+  static void For( const uint& count, ZippedParallelProc procedure, void* context, uint threadsCount = 0 );
+  static ZippedParallelContext* Begin( const uint& count, ZippedParallelProc procedure, void* context, uint threadsCount = 0 );
+  static void End( ZippedParallelContext* loop );
+};
@@ -0,0 +1,365 @@
+#include "ZippedAfx.h"
+
+ZippedSequentialReader::ZippedSequentialReader( FILE* baseStream ) {
+  ZIPASSERT( baseStream != Null, "Can not create a zipped stream. Base stream is Null." );
+  Init();
+  BaseStream = baseStream;
+  CommitHeader();
+}
+
+void ZippedSequentialReader::Init() {
+  Header.Length      = 0;
+  Header.BlockSize   = 0;
+  Header.BlocksCount = 0;
+  memset( &Extension, 0, sizeof( Extension ) );
+  BaseStream    = Null;
+  Dictionary    = Null;
+  Slots         = Null;
+  SlotsCount    = 0;
+  WindowSize    = 0;
+  WindowEnd     = 0;
+  InflateEnd    = 0;
+  ReadEnd       = 0;
+  Inflating     = Null;
+  CurrentBlock  = Invalid;
+  BlockPosition = 0;
+  Position      = 0;
+  InputPosition = 0;
+  InputLength   = 0;
+  Finished      = false;
+  Verification  = false;
+}
+
+void ZippedSequentialReader::ReadInput( void* buffer, const ulong& length ) {
+  ZIPASSERT( fread( buffer, 1, length, BaseStream ) == length, "Zipped stream is truncated." );
+  InputPosition += length;
+}
+
+void ZippedSequentialReader::SkipInput( const ulong& length ) {
+  byte buffer[256];
+  ulong skipped = 0;
+  while( skipped < length ) {
+    ulong size = min( length - skipped, sizeof( buffer ) );
+    ReadInput( buffer, size );
+    skipped += size;
+  }
+}
+
+void ZippedSequentialReader::CommitHeader() {
+  ReadInput( &Header, sizeof( Header ) );
+  if( Header.BlockSize & ZippedHeaderExtended ) {
+    Header.BlockSize &= ~ZippedHeaderExtended;
+
+    // Newer writers may store a longer extension,
+    // so read only the known part and skip the rest
+    ReadInput( &Extension, sizeof( ulong ) * 2 );
+    ZIPASSERT( Extension.Signature == ZippedExtensionSignature, "Bad zipped stream extension signature." );
+    ZIPASSERT( Extension.Size >= sizeof( ulong ) * 2, "Bad zipped stream extension size." );
+    ulong extensionSize = min( Extension.Size, sizeof( Extension ) ) - sizeof( ulong ) * 2;
+    ReadInput( &Extension.Flags, extensionSize );
+    SkipInput( Extension.Size - sizeof( ulong ) * 2 - extensionSize );
+    ZIPASSERT( !(Extension.Flags & ZIPPED_STREAM_ALIGNED) || Extension.BlockAlignment > 0, "Bad zipped stream block alignment." );
+    ZIPASSERT( Extension.DictionaryLength <= ZippedDictionarySizeMax, "Bad zipped stream dictionary length." );
+
+    if( Extension.DictionaryLength > 0 ) {
+      Dictionary = new byte[Extension.DictionaryLength];
+      ReadInput( Dictionary, Extension.DictionaryLength );
+    }
+  }
+
+  ZIPASSERT( Header.BlockSize > 0, "Bad zipped stream block size." );
+}
+
+bool ZippedSequentialReader::ReadBlock( ZippedSequentialBlock& block, const uint& blockID ) {
+  // The streamed chain ends with an empty block header,
+  // the others end after the blocks of the stream header
+  bool streamed = (Extension.Flags & ZIPPED_STREAM_TRAILER) != 0;
+  if( !streamed && blockID >= Header.BlocksCount ) {
+    ZIPASSERT( InputLength == Header.Length, "Bad zipped stream length." );
+    return false;
+  }
+
+  if( Extension.Flags & ZIPPED_STREAM_ALIGNED ) {
+    ulong alignment = Extension.BlockAlignment;
+    SkipInput( (InputPosition + alignment - 1) / alignment * alignment - InputPosition );
+  }
+
+  block.BlockID = Invalid;
+  ReadInput( &block.Header, sizeof( block.Header ) );
+  if( streamed && block.Header.LengthSource == 0 && block.Header.LengthCompressed == 0 && block.Header.BlockSize == 0 ) {
+    ReadTrailer( blockID );
+    return false;
+  }
+
+  ulong extensionSize = Extension.BlockExtensionSize;
+  ulong knownSize = min( extensionSize, sizeof( block.HeaderExtension ) );
+  memset( &block.HeaderExtension, 0, sizeof( block.HeaderExtension ) );
+  ReadInput( &block.HeaderExtension, knownSize );
+  SkipInput( extensionSize - knownSize );
+
+  auto& extension = block.HeaderExtension;
+  ZIPASSERT( block.Header.LengthSource <= Header.BlockSize, "Bad zipped block size." );
+  ZIPASSERT( block.Header.LengthCompressed <= compressBound( Header.BlockSize ), "Bad zipped block size." );
+  ZIPASSERT( !(extension.Flags & ZIPPED_BLOCK_REFERENCE) || extension.Reference < blockID, "Bad zipped block reference." );
+  if( Verification && (Extension.Flags & ZIPPED_STREAM_RECOVERY) && knownSize == sizeof( extension ) ) {
+    ulong checksum = ZippedChecksum::Compute( (byte*)&block.Header, sizeof( block.Header ) );
+    checksum = ZippedChecksum::Compute( (byte*)&extension, offsetof( ZippedBlockExtension, ChecksumHeader ), checksum );
+    bool framed =
+      extension.Signature == ZippedBlockSignature &&
+      extension.Sequence == blockID &&
+      extension.ChecksumHeader == checksum;
+
+    ZIPASSERT( framed, "Bad zipped block frame." );
+  }
+
+  // Fill and reference blocks have no data
+  ReadInput( block.Compressed, block.Header.LengthCompressed );
+  InputLength += block.Header.LengthSource;
+  block.BlockID = blockID;
+  return true;
+}
+
+void ZippedSequentialReader::ReadTrailer( const uint& blocksCount ) {
+  // The block index is not needed, only the trailer is checked
+  SkipInput( sizeof( ulong ) * (blocksCount * 3 + 2) );
+  ZippedStreamTrailer trailer;
+  ReadInput( &trailer, sizeof( trailer ) );
+  bool valid =
+    trailer.Signature == ZippedTrailerSignature &&
+    trailer.Length == InputLength &&
+    trailer.BlocksCount == blocksCount;
+
+  ZIPASSERT( valid, "Bad zipped stream trailer." );
+  Header.Length      = trailer.Length;
+  Header.BlocksCount = trailer.BlocksCount;
+}
+
+void ZippedSequentialReader::ReadWindow() {
+  uint count = 0;
+  while( count < WindowSize && !Finished ) {
+    if( !ReadBlock( Slots[ReadEnd % SlotsCount], ReadEnd ) )
+      Finished = true;
+    else {
+      ReadEnd++;
+      count++;
+    }
+  }
+}
+
+void ZippedSequentialReader::BeginInflate() {
+  Inflating  = ZippedParallel::Begin( ReadEnd - InflateEnd, &InflateTask, this );
+  InflateEnd = ReadEnd;
+}
+
+void ZippedSequentialReader::EndInflate() {
+  ZippedParallelContext* inflating = Inflating;
+  Inflating = Null;
+  ZippedParallel::End( inflating );
+
+  // The references are copied in order, their
+  // blocks are inflated by the window or before it
+  for( uint blockID = WindowEnd; blockID < InflateEnd; blockID++ ) {
+    auto& block = Slots[blockID % SlotsCount];
+    if( !(block.HeaderExtension.Flags & ZIPPED_BLOCK_REFERENCE) )
+      continue;
+
+    uint referenceID = block.HeaderExtension.Reference;
+    auto& reference = Slots[referenceID % SlotsCount];
+    ZIPASSERT( reference.BlockID == referenceID, "Zipped block refers to a block before the sequential reader window." );
+    ZIPASSERT( reference.Header.LengthSource == block.Header.LengthSource, "Zipped block refers to a block of another size." );
+    memcpy( block.Source, reference.Source, block.Header.LengthSource );
+  }
+
+  WindowEnd = InflateEnd;
+}
+
+void ZippedSequentialReader::FillWindow() {
+  if( !Slots ) {
+    // Every worker has two blocks, so a long inflate does not stop the others
+    if( WindowSize == 0 )
+      WindowSize = ZippedParallel::GetThreadsCount() * 2;
+
+    // The caller, the inflated and the read windows have their
+    // slots. The deduplicated streams keep the older blocks
+    // up to the reader cache size for the references
+    SlotsCount = WindowSize * 3;
+    if( Extension.Flags & ZIPPED_STREAM_DEDUPLICATION )
+      SlotsCount += max( WindowSize, CACHE_READER_SIZE_DEFAULT / Header.BlockSize );
+
+    Slots = new ZippedSequentialBlock[SlotsCount];
+    for( uint i = 0; i < SlotsCount; i++ ) {
+      Slots[i].BlockID    = Invalid;
+      Slots[i].Source     = new byte[Header.BlockSize];
+      Slots[i].Compressed = new byte[compressBound( Header.BlockSize )];
+      Slots[i].Filtered   = Null;
+    }
+  }
+
+  if( InflateEnd == WindowEnd ) {
+    ReadWindow();
+    BeginInflate();
+  }
+
+  // The next window is read from the base stream while the
+  // workers inflate this one, a failed read waits for them
+  try {
+    ReadWindow();
+  }
+  catch( const std::exception& ) {
+    try {
+      EndInflate();
+    }
+    catch( const std::exception& ) {
+    }
+
+    throw;
+  }
+
+  EndInflate();
+  BeginInflate();
+}
+
+void ZippedSequentialReader::InflateTask( void* context, const uint& index ) {
+  auto reader = (ZippedSequentialReader*)context;
+  reader->InflateBlock( reader->Slots[(reader->WindowEnd + index) % reader->SlotsCount] );
+}
+
+void ZippedSequentialReader::InflateBlock( ZippedSequentialBlock& block ) {
+  auto& extension = block.HeaderExtension;
+  ulong lengthSource = block.Header.LengthSource;
+  if( extension.Flags & ZIPPED_BLOCK_FILL ) {
+    memset( block.Source, (byte)extension.Reference, lengthSource );
+    return;
+  }
+
+  if( extension.Flags & ZIPPED_BLOCK_REFERENCE )
+    return;
+
+  bool checked = Verification && (extension.Flags & ZIPPED_BLOCK_CHECKSUM);
+  if( checked )
+    ZIPASSERT( ZippedChecksum::Compute( block.Compressed, block.Header.LengthCompressed ) == extension.ChecksumCompressed, "Zipped block is corrupted." );
+
+  ulong length = Header.BlockSize;
+  bool success = ZippedDeflateCodec::Decompress( block.Source, length, block.Compressed, block.Header.LengthCompressed, Dictionary, Extension.DictionaryLength );
+  ZIPASSERT( success && length == lengthSource, "Zipped block is corrupted." );
+
+  if( extension.Filter != 0 ) {
+    if( !block.Filtered )
+      block.Filtered = new byte[Header.BlockSize];
+
+    if( ZippedKernels::RemoveFilter( extension.Filter, block.Source, block.Filtered, length ) ) {
+      byte* source = block.Source;
+      block.Source   = block.Filtered;
+      block.Filtered = source;
+    }
+  }
+
+  if( checked )
+    ZIPASSERT( ZippedChecksum::Compute( block.Source, length ) == extension.ChecksumSource, "Zipped block is corrupted." );
+}
+
+ZippedSequentialBlock* ZippedSequentialReader::GetNextBlock() {
+  uint blockID = CurrentBlock == Invalid ? 0 : CurrentBlock + 1;
+  if( blockID == WindowEnd && (!Finished || ReadEnd > WindowEnd) )
+    FillWindow();
+
+  return blockID < WindowEnd ? &Slots[blockID % SlotsCount] : Null;
+}
+
+ulong ZippedSequentialReader::ReadBlocks( byte* buffer, const ulong& length ) {
+  // The skipped data is inflated too, it is not
+  // known where the blocks of the chain start
+  ulong readedTotal = 0;
+  while( readedTotal < length ) {
+    ZippedSequentialBlock* block = CurrentBlock == Invalid ? Null : &Slots[CurrentBlock % SlotsCount];
+    if( !block || BlockPosition >= block->Header.LengthSource ) {
+      block = GetNextBlock();
+      if( !block )
+        break;
+
+      CurrentBlock  = block->BlockID;
+      BlockPosition = 0;
+      continue;
+    }
+
+    ulong readed = min( length - readedTotal, block->Header.LengthSource - BlockPosition );
+    if( buffer )
+      memcpy( buffer + readedTotal, block->Source + BlockPosition, readed );
+
+    BlockPosition += readed;
+    Position      += readed;
+    readedTotal   += readed;
+  }
+
+  return readedTotal;
+}
+
+void ZippedSequentialReader::SetWindowSize( const uint& blocksCount ) {
+  ZIPASSERT( Slots == Null, "Can not change a zipped stream window after start of reading." );
+  WindowSize = max( blocksCount, 1u );
+}
+
+void ZippedSequentialReader::SetVerification( const bool& enabled ) {
+  Verification = enabled;
+}
+
+ulong ZippedSequentialReader::Read( byte* buffer, const ulong& length ) {
+  return ReadBlocks( buffer, length );
+}
+
+ulong ZippedSequentialReader::Skip( const ulong& length ) {
+  return ReadBlocks( Null, length );
+}
+
+ulong ZippedSequentialReader::Tell() {
+  return Position;
+}
+
+bool ZippedSequentialReader::EndOfFile() {
+  if( CurrentBlock != Invalid && BlockPosition < Slots[CurrentBlock % SlotsCount].Header.LengthSource )
+    return false;
+
+  return GetNextBlock() == Null;
+}
+
+ulong ZippedSequentialReader::GetLength() {
+  // The streamed streams have the length in the trailer
+  return Header.Length;
+}
+
+ulong ZippedSequentialReader::GetBlockSize() {
+  return Header.BlockSize;
+}
+
+uint ZippedSequentialReader::GetBlocksCount() {
+  return Header.BlocksCount;
+}
+
+ulong ZippedSequentialReader::GetFlags() {
+  return Extension.Flags;
+}
+
+void ZippedSequentialReader::Close( const bool& closeBaseStream ) {
+  FILE* baseStream = BaseStream;
+  delete this;
+  if( closeBaseStream && baseStream )
+    fclose( baseStream );
+}
+
+ZippedSequentialReader::~ZippedSequentialReader() {
+  // The workers must leave the slots first
+  try {
+    ZippedParallel::End( Inflating );
+  }
+  catch( const std::exception& ) {
+  }
+
+  for( uint i = 0; i < SlotsCount; i++ ) {
+    delete[] Slots[i].Source;
+    delete[] Slots[i].Compressed;
+    delete[] Slots[i].Filtered;
+  }
+
+  delete[] Slots;
+  delete[] Dictionary;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+
+
+// Block of the sequential reader window
+struct ZippedSequentialBlock {
+  ZippedBlockHeader Header;
+  ZippedBlockExtension HeaderExtension;
+  uint BlockID; // Invalid for an empty slot
+  byte* Source;
+  byte* Compressed;
+  byte* Filtered; // Created by the first filtered block
+};
+
+// Forward-only reader of the streams from pipes and sockets. The
+// headers are parsed from the base stream in order, a window of
+// the next blocks is read ahead and inflated by the workers while
+// the following window is read, then the blocks are given to the
+// caller in order, so the memory does not depend on the stream
+// length. The deduplicated streams keep the older blocks up to
+// the reader cache size, the references to the blocks before
+// them can not be read.
+class ZSTREAMAPI ZippedSequentialReader {
+protected:
+  struct {
+    ulong Length;
+    ulong BlockSize;
+    uint BlocksCount;
+  }
+  Header;
+  ZippedStreamExtension Extension;
+  FILE* BaseStream;
+  byte* Dictionary;
+  ZippedSequentialBlock* Slots; // Block ID modulo the count is the slot
+  uint SlotsCount;
+  uint WindowSize;     // Blocks inflated together
+  uint WindowEnd;      // Blocks ready for the caller
+  uint InflateEnd;     // Blocks given to the workers
+  uint ReadEnd;        // Blocks read from the base stream
+  ZippedParallelContext* Inflating; // Loop of the blocks after the WindowEnd
+  uint CurrentBlock;   // Block of the caller, Invalid before the first one
+  ulong BlockPosition; // Position in the current block
+  ulong Position;
+  ulong InputPosition; // Bytes read from the base stream
+  ulong InputLength;   // Uncompressed length of the read blocks
+  bool Finished;       // The end of the block chain is read
+  bool Verification;
+
+  void Init();
+  void ReadInput( void* buffer, const ulong& length );
+  void SkipInput( const ulong& length );
+  void CommitHeader();
+  bool ReadBlock( ZippedSequentialBlock& block, const uint& blockID );
+  void ReadTrailer( const uint& blocksCount );
+  void ReadWindow();
+  void BeginInflate();
+  void EndInflate();
+  void FillWindow();
+  void InflateBlock( ZippedSequentialBlock& block );
+  ZippedSequentialBlock* GetNextBlock();
+  ulong ReadBlocks( byte* buffer, const ulong& length );
+  static void InflateTask( void* context, const uint& index );
+
+public:
+  ZippedSequentialReader( FILE* baseStream );
+  virtual void SetWindowSize( const uint& blocksCount );
+  virtual void SetVerification( const bool& enabled );
+  virtual ulong Read( byte* buffer, const ulong& length );
+  virtual ulong Skip( const ulong& length );
+  virtual ulong Tell();
+  virtual bool EndOfFile();
+  virtual ulong GetLength();
+  virtual ulong GetBlockSize();
+  virtual uint GetBlocksCount();
+  virtual ulong GetFlags();
+  virtual void Close( const bool& closeBaseStream = true );
+  virtual ~ZippedSequentialReader();
+};
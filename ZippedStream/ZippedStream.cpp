@@ -10,19 +10,40 @@ ZSTREAMAPI ulong ZIPPED_THREADS_COUNT         = 8;
 ZSTREAMAPI ulong BLOCK_SIZE_DEFAULT           = 1024 * 1024 / 4; // 0.25MB
 ZSTREAMAPI ulong CACHE_READER_SIZE_DEFAULT    = 1024 * 1024 * 8; // 8MB
 ZSTREAMAPI ulong CACHE_READER_STACK_COUNT_MAX = 1024;
+ZSTREAMAPI ulong PARALLEL_MEMORY_LIMIT        = 1024 * 1024 * 256; // 256MB
+ZSTREAMAPI ulong PARALLEL_THREADS_COUNT       = 0; // All cores
 }
 
 
 #pragma region base
 ZippedStreamBase::ZippedStreamBase( FILE* baseStream, long position ) {
   ZIPASSERT( baseStream != Null, "Can not create a zipped stream. Base stream is Null." );
+  Init();
   BaseStream         = baseStream;
   BasePosition       = position;
+}
+
+ZippedStreamBase::ZippedStreamBase( ZippedMemory* memory ) {
+  ZIPASSERT( memory != Null, "Can not create a zipped stream. Memory is Null." );
+  Init();
+  Memory             = memory;
+}
+
+void ZippedStreamBase::Init() {
+  BaseStream         = Null;
+  Memory             = Null;
+  BasePosition       = 0;
   Position           = 0;
   Blocks             = Null;
+  BlockOffsets       = Null;
   Header.Length      = 0;
   Header.BlockSize   = BLOCK_SIZE_DEFAULT;
   Header.BlocksCount = 0;
+  Dictionary         = Null;
+  memset( &Extension, 0, sizeof( Extension ) );
+  Extension.Signature          = ZippedExtensionSignature;
+  Extension.Size               = sizeof( Extension );
+  Extension.BlockExtensionSize = sizeof( ZippedBlockExtension );
 }
 
 long ZippedStreamBase::Tell() {
@@ -43,27 +64,61 @@ long ZippedStreamBase::Seek( const long& offset, const uint& origin ) {
   return Position;
 }
 
-bool ZippedStreamBase::Compress( const bool& clearSource ) {
-  bool success = true;
-  for( uint i = 0; i < Header.BlocksCount; i++ )
-    if( !Blocks[i]->Compress( clearSource ) )
-      success = false;
+struct ZippedStreamTask {
+  ZippedStreamBase* Stream;
+  bool Option;
+  volatile long Failed;
+};
 
-  return success;
+uint ZippedStreamBase::GetParallelThreadsCount() {
+  // Every worker holds the source and the compressed data of one block
+  ulong blockMemory = Header.BlockSize + compressBound( Header.BlockSize );
+  ulong threadsCount = max( 1ul, PARALLEL_MEMORY_LIMIT / blockMemory );
+  return min( (ulong)ZippedParallel::GetThreadsCount(), threadsCount );
 }
 
-bool ZippedStreamBase::Decompress( const bool& clearCompressed ) {
-  bool success = true;
-  for( uint i = 0; i < Header.BlocksCount; i++ )
-    if( !Blocks[i]->Decompress( clearCompressed ) )
-      success = false;
+bool ZippedStreamBase::CompressBlock( const uint& blockID, const bool& clearSource ) {
+  return Blocks[blockID]->Compress( clearSource );
+}
+
+bool ZippedStreamBase::DecompressBlock( const uint& blockID, const bool& clearCompressed ) {
+  return Blocks[blockID]->Decompress( clearCompressed );
+}
+
+void ZippedStreamBase::CompressTask( void* context, const uint& blockID ) {
+  auto& task = *(ZippedStreamTask*)context;
+  if( !task.Stream->CompressBlock( blockID, task.Option ) )
+    InterlockedIncrement( &task.Failed );
+}
+
+void ZippedStreamBase::DecompressTask( void* context, const uint& blockID ) {
+  auto& task = *(ZippedStreamTask*)context;
+  if( !task.Stream->DecompressBlock( blockID, task.Option ) )
+    InterlockedIncrement( &task.Failed );
+}
 
-  return success;
+bool ZippedStreamBase::Compress( const bool& clearSource ) {
+  ZippedStreamTask task;
+  task.Stream = this;
+  task.Option = clearSource;
+  task.Failed = 0;
+  ZippedParallel::For( Header.BlocksCount, &CompressTask, &task, GetParallelThreadsCount() );
+  return task.Failed == 0;
+}
+
+bool ZippedStreamBase::Decompress( const bool& clearCompressed ) {
+  ZippedStreamTask task;
+  task.Stream = this;
+  task.Option = clearCompressed;
+  task.Failed = 0;
+  ZippedParallel::For( Header.BlocksCount, &DecompressTask, &task, GetParallelThreadsCount() );
+  return task.Failed == 0;
 }
 
 void ZippedStreamBase::SetBlockSize( const ulong& length ) {
   for( uint i = 0; i < Header.BlocksCount; i++ )
-    Blocks[i]->SetBlockSize( length );
+    if( Blocks[i] )
+      Blocks[i]->SetBlockSize( length );
 
   Header.BlockSize = length;
 }
@@ -72,31 +127,175 @@ ulong ZippedStreamBase::GetBlockSize() {
   return Header.BlockSize;
 }
 
+void ZippedStreamBase::SetDictionary( byte* buffer, const ulong& length ) {
+  ulong size = min( length, ZippedDictionarySizeMax );
+  delete[] Dictionary;
+  Dictionary = Null;
+  Extension.DictionaryLength = 0;
+  Extension.Flags &= ~ZIPPED_STREAM_DICTIONARY;
+  if( size == 0 )
+    return;
+
+  // deflate uses the end of the dictionary first,
+  // so the tail of a long buffer is the best part
+  Dictionary = new byte[size];
+  memcpy( Dictionary, buffer + length - size, size );
+  Extension.DictionaryLength = size;
+  Extension.Flags |= ZIPPED_STREAM_DICTIONARY;
+}
+
+void ZippedStreamBase::BuildDictionary( byte* sample, const ulong& length ) {
+  static const ulong SliceSize = 256;
+  if( length <= ZippedDictionarySizeMax ) {
+    SetDictionary( sample, length );
+    return;
+  }
+
+  // Collect evenly spaced slices of the sample so the
+  // dictionary covers the whole data, not only its tail
+  byte* dictionary = new byte[ZippedDictionarySizeMax];
+  ulong slicesCount = ZippedDictionarySizeMax / SliceSize;
+  ulong step = (length - SliceSize) / (slicesCount - 1);
+  for( ulong i = 0; i < slicesCount; i++ )
+    memcpy( dictionary + i * SliceSize, sample + i * step, SliceSize );
+
+  SetDictionary( dictionary, ZippedDictionarySizeMax );
+  delete[] dictionary;
+}
+
+bool ZippedStreamBase::IsExtended() {
+  return Extension.Flags != 0;
+}
+
+bool ZippedStreamBase::IsChunked() {
+  return (Extension.Flags & ZIPPED_STREAM_CHUNKED) != 0;
+}
+
+uint ZippedStreamBase::FindBlock( const ulong& position ) {
+  if( !IsChunked() )
+    return position / Header.BlockSize;
+
+  // The last block which starts at or before the position
+  uint low = 0;
+  uint high = Header.BlocksCount;
+  while( high - low > 1 ) {
+    uint middle = (low + high) / 2;
+    if( BlockOffsets[middle] <= position )
+      low = middle;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+ulong ZippedStreamBase::GetHeaderSize() {
+  ulong headerSize = sizeof( Header );
+  if( IsExtended() )
+    headerSize += Extension.Size + Extension.DictionaryLength;
+
+  return headerSize;
+}
+
+ulong ZippedStreamBase::GetBlockExtensionSize() {
+  return IsExtended() ? Extension.BlockExtensionSize : 0;
+}
+
+void ZippedStreamBase::InitBlock( ZippedBlockBase* block ) {
+  block->Buffer.SetDictionary( Dictionary, Extension.DictionaryLength );
+}
+
 void ZippedStreamBase::Close( const bool& closeBaseStream ) {
+  // The memory is owned by the caller
   FILE* baseStream = BaseStream;
   delete this;
-  if( closeBaseStream )
+  if( closeBaseStream && baseStream )
     fclose( baseStream );
 }
 
+ZippedMemory* ZippedStreamBase::GetMemory() {
+  return Memory;
+}
+
+ulong ZippedStreamBase::AlignBlockOffset( const ulong& offset ) {
+  if( !(Extension.Flags & ZIPPED_STREAM_ALIGNED) )
+    return offset;
+
+  ulong alignment = Extension.BlockAlignment;
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
 ulong ZippedStreamBase::GetStreamSize() {
-  ulong totalSize = sizeof( Header );
+  ulong totalSize = GetHeaderSize();
   for( uint i = 0; i < Header.BlocksCount; i++ ) {
-    auto& header = Blocks[i]->Header;
-    if( header.LengthCompressed != 0 )
-      totalSize += sizeof( header ) + header.LengthCompressed;
+    // Not flushed blocks of the writer have no size
+    ulong fileSize = Blocks[i]->GetFileSize();
+    if( fileSize > 0 )
+      totalSize = AlignBlockOffset( totalSize ) + fileSize;
   }
 
   return totalSize;
 }
 
+ulong ZippedStreamBase::GetLength() {
+  return Header.Length;
+}
+
+uint ZippedStreamBase::GetBlocksCount() {
+  return Header.BlocksCount;
+}
+
+ulong ZippedStreamBase::GetFlags() {
+  return IsExtended() ? Extension.Flags : 0;
+}
+
+bool ZippedStreamBase::HasHeaderChecksum() {
+  // The streams of the older writers have no checksum
+  return IsExtended() && Extension.Size >= offsetof( ZippedStreamExtension, HeaderChecksum ) + sizeof( ulong );
+}
+
+ulong ZippedStreamBase::ComputeHeaderChecksum( const void* header, const ZippedStreamExtension& extension ) {
+  ulong checksum = ZippedChecksum::Compute( (byte*)header, sizeof( Header ) );
+  return ZippedChecksum::Compute( (byte*)&extension, offsetof( ZippedStreamExtension, HeaderChecksum ), checksum );
+}
+
+void ZippedStreamBase::ReadHeader() {
+  ZippedMemory::ReadAt( BaseStream, Memory, &Header, BasePosition, sizeof( Header ) );
+  auto header = Header;
+  if( Header.BlockSize & ZippedHeaderExtended ) {
+    Header.BlockSize &= ~ZippedHeaderExtended;
+
+    // Newer writers may store a longer extension,
+    // so read only the known part and skip the rest
+    ZippedStreamExtension extension;
+    memset( &extension, 0, sizeof( extension ) );
+    ulong position = BasePosition + sizeof( Header );
+    ZippedMemory::ReadAt( BaseStream, Memory, &extension, position, sizeof( ulong ) * 2 );
+    ZIPASSERT( extension.Signature == ZippedExtensionSignature, "Bad zipped stream extension signature." );
+    ZIPASSERT( extension.Size >= sizeof( ulong ) * 2, "Bad zipped stream extension size." );
+    ulong extensionSize = min( extension.Size, sizeof( extension ) ) - sizeof( ulong ) * 2;
+    ZippedMemory::ReadAt( BaseStream, Memory, &extension.Flags, position + sizeof( ulong ) * 2, extensionSize );
+    Extension = extension;
+    ZIPASSERT( !(Extension.Flags & ZIPPED_STREAM_ALIGNED) || Extension.BlockAlignment > 0, "Bad zipped stream block alignment." );
+    ZIPASSERT( !HasHeaderChecksum() || ComputeHeaderChecksum( &header, extension ) == extension.HeaderChecksum, "Bad zipped stream header checksum." );
+
+    if( Extension.DictionaryLength > 0 ) {
+      Dictionary = new byte[Extension.DictionaryLength];
+      ZippedMemory::ReadAt( BaseStream, Memory, Dictionary, position + extension.Size, Extension.DictionaryLength );
+    }
+  }
+}
+
 ZippedStreamBase::~ZippedStreamBase() {
-  for( uint i = 0; i < Header.BlocksCount; i++ ) {
+  // A bad header throws before the blocks are created
+  for( uint i = 0; Blocks && i < Header.BlocksCount; i++ ) {
     delete Blocks[i];
     Blocks[i] = Null;
   }
 
   delete[] Blocks;
+  delete[] BlockOffsets;
+  delete[] Dictionary;
 }
 #pragma endregion
 
@@ -104,59 +303,865 @@ ZippedStreamBase::~ZippedStreamBase() {
 
 #pragma region reader
 ZippedStreamReader::ZippedStreamReader( FILE* baseStream, long position ) : ZippedStreamBase( baseStream, position ) {
+  Init();
+  CommitHeader();
+  CommitData();
+}
+
+ZippedStreamReader::ZippedStreamReader( ZippedMemory* memory ) : ZippedStreamBase( memory ) {
+  Init();
   CommitHeader();
   CommitData();
 }
 
+void ZippedStreamReader::Init() {
+  AsyncFile       = Null;
+  Verification    = false;
+  BlockPositions  = Null;
+  BlockLengths    = Null;
+  LiveBlocksLimit = ZippedLiveBlocksMin;
+  DiscoveredCount = 0;
+  DiscoveryPosition       = 0;
+  DiscoveryOffset         = 0;
+  DiscoveryWindow         = Null;
+  DiscoveryWindowPosition = 0;
+  DiscoveryWindowLength   = 0;
+  DiscoveryWindowSize     = 0;
+  IndexFileName           = Null;
+  ReadView.Data   = Null;
+  ReadView.Length = 0;
+  ReadView.Block  = Null;
+  ReadPosition    = 0;
+  ReadPointer     = Null;
+  ReadEnd         = Null;
+}
+
+void ZippedStreamReader::SetDictionary( byte* buffer, const ulong& length ) {
+  throw std::exception( "Can not change a dictionary in the read-only object." );
+}
+
+void ZippedStreamReader::SetVerification( const bool& enabled ) {
+  Verification = enabled;
+  for( uint i = 0; i < LiveBlocks.GetNum(); i++ )
+    ((ZippedBlockReader*)Blocks[LiveBlocks[i]])->SetVerification( enabled );
+}
+
+void ZippedStreamReader::VerifyTask( void* context, const uint& blockID ) {
+  auto& task = *(ZippedStreamTask*)context;
+  auto stream = (ZippedStreamReader*)task.Stream;
+
+  // The workers use own block objects, so the live blocks are not touched
+  auto block = stream->CreateBlock( blockID );
+  if( !block->HasPayload() ) {
+    delete block;
+    return;
+  }
+
+  bool valid;
+  if( task.Option ) {
+    ZippedBuffer buffer;
+    valid = block->DecompressTo( buffer, stream->BaseStreamMutex, true );
+  }
+  else {
+    // The base stream is shared, so only reading is serialized
+    byte* data = new byte[block->Header.LengthCompressed];
+    ulong readed = block->ReadCompressed( data, stream->BaseStreamMutex );
+    valid = block->VerifyCompressed( data, readed );
+    delete[] data;
+  }
+
+  delete block;
+  if( !valid )
+    InterlockedIncrement( &task.Failed );
+}
+
+bool ZippedStreamReader::Verify( const bool& decompress ) {
+  ZippedStreamTask task;
+  task.Stream = this;
+  task.Option = decompress;
+  task.Failed = 0;
+
+  DiscoverBlock( Header.BlocksCount - 1 );
+  ZippedParallel::For( Header.BlocksCount, &VerifyTask, &task, decompress ? GetParallelThreadsCount() : 0 );
+  return task.Failed == 0;
+}
+
+bool ZippedStreamReader::DecompressBlock( const uint& blockID, const bool& clearCompressed ) {
+  return ((ZippedBlockReader*)Blocks[blockID])->Materialize( BaseStreamMutex );
+}
+
+bool ZippedStreamReader::Decompress( const bool& clearCompressed ) {
+  // Loads the whole stream into memory, the blocks
+  // are not limited by the cache size after that
+  LiveBlocksLimit = Header.BlocksCount + 1;
+  for( uint i = 0; i < Header.BlocksCount; i++ )
+    GetBlock( i );
+
+  return ZippedStreamBase::Decompress( clearCompressed );
+}
+
+struct ZippedExtractContext {
+  ZippedStreamReader* Stream;
+  HANDLE File;
+  ULONGLONG FileOffset;
+  ulong Begin;
+  ulong End;
+  uint FirstBlock;
+  bool Zeroed; // The range is beyond the old end of the file
+};
+
+static bool WriteFileAt( HANDLE file, const byte* buffer, const ulong& length, const ULONGLONG& offset ) {
+  // The offset in OVERLAPPED makes the write positional
+  // for both the synchronous and the overlapped handles
+  OVERLAPPED overlapped;
+  memset( &overlapped, 0, sizeof( overlapped ) );
+  overlapped.Offset     = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  overlapped.hEvent     = CreateEvent( Null, True, False, Null );
+
+  DWORD writed = 0;
+  BOOL result = WriteFile( file, buffer, length, &writed, &overlapped );
+  if( !result && GetLastError() == ERROR_IO_PENDING )
+    result = GetOverlappedResult( file, &overlapped, &writed, True );
+
+  CloseHandle( overlapped.hEvent );
+  return result && writed == length;
+}
+
+void ZippedStreamReader::ExtractTask( void* context, const uint& index ) {
+  auto& extract = *(ZippedExtractContext*)context;
+  auto stream = extract.Stream;
+  uint blockID = extract.FirstBlock + index;
+  auto block = stream->CreateBlock( blockID );
+  ulong from = max( extract.Begin, stream->BlockOffsets[blockID] );
+  ulong to = min( extract.End, stream->BlockOffsets[blockID + 1] );
+  ulong length = to - from;
+  ULONGLONG fileOffset = extract.FileOffset + (from - extract.Begin);
+
+  if( block->IsFill() ) {
+    byte value = (byte)block->HeaderExtension.Reference;
+    delete block;
+    if( value == 0 && extract.Zeroed )
+      return;
+
+    byte* buffer = new byte[length];
+    memset( buffer, value, length );
+    bool writed = WriteFileAt( extract.File, buffer, length, fileOffset );
+    delete[] buffer;
+    ZIPASSERT( writed, "Can not write the extracted zipped block." );
+    return;
+  }
+
+  // The referenced block is decompressed once more, so
+  // the workers do not share the buffers of the blocks
+  if( block->IsReference() ) {
+    uint referenceID = block->HeaderExtension.Reference;
+    ZIPASSERT( referenceID < blockID, "Bad zipped block reference." );
+    delete block;
+    block = stream->CreateBlock( referenceID );
+  }
+
+  ZippedBuffer buffer;
+  bool decompressed = block->DecompressTo( buffer, stream->BaseStreamMutex, true );
+  delete block;
+  ZIPASSERT( decompressed, "Zipped block is corrupted." );
+  byte* source = buffer.Source.GetBuffer() + (from - stream->BlockOffsets[blockID]);
+  ZIPASSERT( WriteFileAt( extract.File, source, length, fileOffset ), "Can not write the extracted zipped block." );
+}
+
+ulong ZippedStreamReader::ExtractTo( HANDLE file, const ULONGLONG& fileOffset, const ulong& position, const ulong& length ) {
+  ZIPASSERT( file != Null && file != INVALID_HANDLE_VALUE, "Can not extract a zipped stream. File handle is invalid." );
+  if( position >= Header.Length || length == 0 )
+    return 0;
+
+  ZippedExtractContext extract;
+  extract.Stream     = this;
+  extract.File       = file;
+  extract.FileOffset = fileOffset;
+  extract.Begin      = position;
+  extract.End        = length < Header.Length - position ? position + length : Header.Length;
+  DiscoverBlocks( extract.End - 1 );
+  extract.FirstBlock = FindBlock( extract.Begin );
+  uint lastBlock     = FindBlock( extract.End - 1 );
+
+  // The file is extended at once, so the parallel
+  // writes do not grow it piece by piece
+  LARGE_INTEGER fileSize;
+  ZIPASSERT( GetFileSizeEx( file, &fileSize ), "Can not get the size of the extracted file." );
+  ULONGLONG fileEnd = fileOffset + (extract.End - extract.Begin);
+  extract.Zeroed = (ULONGLONG)fileSize.QuadPart <= fileOffset;
+  if( (ULONGLONG)fileSize.QuadPart < fileEnd ) {
+    LARGE_INTEGER zero, current, size;
+    zero.QuadPart = 0;
+    size.QuadPart = fileEnd;
+    SetFilePointerEx( file, zero, &current, FILE_CURRENT );
+    bool extended = SetFilePointerEx( file, size, Null, FILE_BEGIN ) && SetEndOfFile( file );
+    SetFilePointerEx( file, current, Null, FILE_BEGIN );
+    ZIPASSERT( extended, "Can not preallocate the extracted file." );
+  }
+
+  // Every worker keeps one block in flight
+  ZippedParallel::For( lastBlock - extract.FirstBlock + 1, &ExtractTask, &extract, GetParallelThreadsCount() );
+  return extract.End - extract.Begin;
+}
+
+// Part of a batched read inside one block
+struct ZippedReadPiece {
+  uint BlockID;
+  uint Range;
+  ulong BlockPosition;
+  ulong Offset; // Position in the buffer of the range
+  ulong Length;
+
+  bool operator < ( const ZippedReadPiece& other ) const { return BlockID < other.BlockID; }
+  bool operator > ( const ZippedReadPiece& other ) const { return BlockID > other.BlockID; }
+};
+
+struct ZippedReadGroup {
+  uint BlockID;
+  uint FirstPiece;
+  uint PiecesCount;
+};
+
+struct ZippedReadContext {
+  ZippedStreamReader* Stream;
+  ZippedReadRange* Ranges;
+  ZippedReadPiece* Pieces;
+  ZippedReadGroup* Groups;
+};
+
+static void CopyPieces( ZippedReadContext& read, const ZippedReadGroup& group, const byte* source ) {
+  for( uint i = 0; i < group.PiecesCount; i++ ) {
+    auto& piece = read.Pieces[group.FirstPiece + i];
+    memcpy( read.Ranges[piece.Range].Buffer + piece.Offset, source + piece.BlockPosition, piece.Length );
+  }
+}
+
+void ZippedStreamReader::ReadVTask( void* context, const uint& index ) {
+  auto& read = *(ZippedReadContext*)context;
+  auto stream = read.Stream;
+  auto& group = read.Groups[index];
+  auto block = stream->CreateBlock( group.BlockID );
+
+  if( block->IsFill() ) {
+    // The fill value is written to the pieces
+    byte value = (byte)block->HeaderExtension.Reference;
+    delete block;
+    for( uint i = 0; i < group.PiecesCount; i++ ) {
+      auto& piece = read.Pieces[group.FirstPiece + i];
+      memset( read.Ranges[piece.Range].Buffer + piece.Offset, value, piece.Length );
+    }
+    return;
+  }
+
+  if( block->IsReference() ) {
+    uint referenceID = block->HeaderExtension.Reference;
+    delete block;
+    ZIPASSERT( referenceID < group.BlockID, "Bad zipped block reference." );
+    block = stream->CreateBlock( referenceID );
+  }
+
+  ZippedBuffer buffer;
+  bool decompressed = block->DecompressTo( buffer, stream->BaseStreamMutex, stream->Verification );
+  delete block;
+  ZIPASSERT( decompressed, "Zipped block is corrupted." );
+  CopyPieces( read, group, buffer.Source.GetBuffer() );
+}
+
+ulong ZippedStreamReader::ReadV( ZippedReadRange* ranges, const uint& count ) {
+  // The ranges are split by the blocks
+  Common::Array<ZippedReadPiece> pieces;
+  ulong readedTotal = 0;
+  for( uint i = 0; i < count; i++ ) {
+    auto& range = ranges[i];
+    range.Readed = 0;
+    if( range.Position >= Header.Length || range.Length == 0 )
+      continue;
+
+    ulong end = range.Length < Header.Length - range.Position ? range.Position + range.Length : Header.Length;
+    DiscoverBlocks( end - 1 );
+    for( uint blockID = FindBlock( range.Position ); BlockOffsets[blockID] < end; blockID++ ) {
+      ulong from = max( range.Position, BlockOffsets[blockID] );
+      ulong to = min( end, BlockOffsets[blockID + 1] );
+      ZippedReadPiece piece;
+      piece.BlockID       = blockID;
+      piece.Range         = i;
+      piece.BlockPosition = from - BlockOffsets[blockID];
+      piece.Offset        = from - range.Position;
+      piece.Length        = to - from;
+      pieces.Insert( piece );
+    }
+
+    range.Readed = end - range.Position;
+    readedTotal += range.Readed;
+  }
+
+  if( pieces.IsEmpty() )
+    return 0;
+
+  // Every block is loaded once for all of its pieces
+  pieces.QuickSort();
+  Common::Array<ZippedReadGroup> groups;
+  for( uint i = 0; i < pieces.GetNum(); i++ ) {
+    if( groups.IsEmpty() || groups.GetLast().BlockID != pieces[i].BlockID ) {
+      ZippedReadGroup group;
+      group.BlockID     = pieces[i].BlockID;
+      group.FirstPiece  = i;
+      group.PiecesCount = 0;
+      groups.Insert( group );
+    }
+
+    groups.GetLast().PiecesCount++;
+  }
+
+  ZippedReadContext read;
+  read.Stream   = this;
+  read.Ranges   = ranges;
+  read.Pieces   = &pieces[0];
+
+  // The cached blocks are copied by the calling thread,
+  // the others are loaded by the workers in their own objects
+  Common::Array<ZippedReadGroup> loads;
+  for( uint i = 0; i < groups.GetNum(); i++ ) {
+    auto block = (ZippedBlockReader*)Blocks[groups[i].BlockID];
+    ZippedView view;
+    if( !block || !block->Cached() || !block->Borrow( 0, Invalid, view ) ) {
+      loads.Insert( groups[i] );
+      continue;
+    }
+
+    CopyPieces( read, groups[i], view.Data );
+    Release( view );
+  }
+
+  if( !loads.IsEmpty() ) {
+    read.Groups = &loads[0];
+    ZippedParallel::For( loads.GetNum(), &ReadVTask, &read, GetParallelThreadsCount() );
+  }
+
+  return readedTotal;
+}
+
 void ZippedStreamReader::CommitHeader() {
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition, SEEK_SET );
-  fread( &Header, 1, sizeof( Header ), BaseStream );
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  ReadHeader();
 }
 
 void ZippedStreamReader::CommitData() {
-  long returnPosition = ftell( BaseStream );
-  long position = BasePosition + sizeof( Header );
+  // Without the private handle the blocks are read on the calling thread
+  if( BaseStream )
+    AsyncFile = ZippedAsyncIO::GetInstance().Open( BaseStream );
 
-  Blocks = new ZippedBlockBase*[Header.BlocksCount];
-  for( uint i = 0; i < Header.BlocksCount; i++ ) {
-    Blocks[i] = new ZippedBlockReader( BaseStream, position );
-    position += Blocks[i]->GetFileSize();
+  // The streamed writers list the blocks in the trailer. Without
+  // the trailer a recoverable stream is left for the Recover call
+  ZippedStreamTrailer trailer;
+  bool trailed = false;
+  if( Extension.Flags & ZIPPED_STREAM_TRAILER ) {
+    trailed = ReadTrailer( trailer );
+    ZIPASSERT( trailed || (Extension.Flags & ZIPPED_STREAM_RECOVERY), "Zipped stream trailer is missing." );
+    if( trailed ) {
+      Header.Length      = trailer.Length;
+      Header.BlocksCount = trailer.BlocksCount;
+    }
   }
 
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  uint blocksCount = Header.BlocksCount;
+  Blocks         = new ZippedBlockBase*[blocksCount];
+  BlockOffsets   = new ulong[blocksCount + 1];
+  BlockPositions = new ulong[blocksCount + 1];
+  BlockLengths   = new ulong[blocksCount];
+  for( uint i = 0; i < blocksCount; i++ ) {
+    Blocks[i]       = Null;
+    BlockOffsets[i] = Header.Length;
+  }
+
+  BlockOffsets[blocksCount] = Header.Length;
+  BlockPositions[blocksCount] = BasePosition + GetHeaderSize();
+  DiscoveryPosition = GetHeaderSize();
+  if( !trailed )
+    return;
+
+  ulong position = BasePosition + trailer.IndexPosition;
+  position += ZippedMemory::ReadAt( BaseStream, Memory, BlockOffsets,   position, sizeof( ulong ) * (blocksCount + 1) );
+  position += ZippedMemory::ReadAt( BaseStream, Memory, BlockPositions, position, sizeof( ulong ) * (blocksCount + 1) );
+  ZippedMemory::ReadAt( BaseStream, Memory, BlockLengths, position, sizeof( ulong ) * blocksCount );
+  ZIPASSERT( BlockOffsets[blocksCount] == Header.Length, "Bad zipped stream trailer." );
+  for( uint i = 0; i <= blocksCount; i++ )
+    BlockPositions[i] += BasePosition;
+
+  DiscoveredCount   = blocksCount;
+  DiscoveryOffset   = Header.Length;
+  DiscoveryPosition = BlockPositions[blocksCount] - BasePosition;
 }
 
-ZippedBlockBase* ZippedStreamReader::GetBlockToRead() {
-  uint blockID = Position / Header.BlockSize;
-  uint blockPosition = Position - blockID * Header.BlockSize;
-  auto block = Blocks[blockID];
-  block->Seek( blockPosition );
+bool ZippedStreamReader::ReadTrailer( ZippedStreamTrailer& trailer ) {
+  // The trailer ends the file or the memory
+  ULONGLONG size = 0;
+  ULONGLONG time = 0;
+  if( Memory )
+    size = Memory->GetLength();
+  else if( !ZippedIndex::GetFileStamp( BaseStream, size, time ) )
+    return false;
+
+  if( size < BasePosition + GetHeaderSize() + sizeof( trailer ) )
+    return false;
+
+  ulong position = (ulong)size - sizeof( trailer );
+  ZippedMemory::ReadAt( BaseStream, Memory, &trailer, position, sizeof( trailer ) );
+  ulong indexSize = sizeof( ulong ) * (trailer.BlocksCount * 3 + 2);
+  return
+    trailer.Signature == ZippedTrailerSignature &&
+    trailer.BlocksCount <= position / (sizeof( ulong ) * 3) &&
+    BasePosition + trailer.IndexPosition + indexSize == position;
+}
+
+void ZippedStreamReader::ReadHeaderChain( void* buffer, const ulong& position, const ulong& length ) {
+  ulong windowEnd = DiscoveryWindowPosition + DiscoveryWindowLength;
+  if( Memory || (position >= DiscoveryWindowPosition && position + length <= windowEnd) ) {
+    if( Memory )
+      ZippedMemory::ReadAt( BaseStream, Memory, buffer, position, length );
+    else
+      memcpy( buffer, DiscoveryWindow + (position - DiscoveryWindowPosition), length );
+    return;
+  }
+
+  // The window is refilled when it holds several headers,
+  // the headers of the large blocks are read one by one
+  ulong blockSize = DiscoveredCount > 0 ? BlockLengths[DiscoveredCount - 1] : Header.BlockSize;
+  BaseStreamMutex.Enter();
+  if( blockSize < ZippedDiscoveryWindowMax / 4 ) {
+    if( DiscoveryWindowSize < ZippedDiscoveryWindowMax ) {
+      DiscoveryWindowSize = DiscoveryWindowSize ? DiscoveryWindowSize * 2 : ZippedDiscoveryWindowMin;
+      delete[] DiscoveryWindow;
+      DiscoveryWindow = new byte[DiscoveryWindowSize];
+    }
+
+    DiscoveryWindowPosition = position;
+    DiscoveryWindowLength   = ZippedMemory::ReadAt( BaseStream, Memory, DiscoveryWindow, position, DiscoveryWindowSize );
+  }
+  else
+    DiscoveryWindowLength = 0;
+  BaseStreamMutex.Leave();
+
+  if( DiscoveryWindowLength >= length )
+    memcpy( buffer, DiscoveryWindow, length );
+  else {
+    BaseStreamMutex.Enter();
+    ZippedMemory::ReadAt( BaseStream, Memory, buffer, position, length );
+    BaseStreamMutex.Leave();
+  }
+}
+
+void ZippedStreamReader::DiscoverNext() {
+  uint blockID = DiscoveredCount;
+  ulong position = AlignBlockOffset( DiscoveryPosition );
+  ZippedBlockHeader blockHeader;
+  memset( &blockHeader, 0, sizeof( blockHeader ) );
+  ReadHeaderChain( &blockHeader, BasePosition + position, sizeof( blockHeader ) );
+  ZIPASSERT( DiscoveryOffset + blockHeader.LengthSource <= Header.Length, "Bad zipped block size." );
+
+  BlockOffsets[blockID]   = DiscoveryOffset;
+  BlockPositions[blockID] = BasePosition + position;
+  BlockLengths[blockID]   = blockHeader.LengthCompressed;
+  DiscoveryOffset  += blockHeader.LengthSource;
+  DiscoveryPosition = position + sizeof( blockHeader ) + GetBlockExtensionSize() + blockHeader.LengthCompressed;
+  DiscoveredCount++;
+
+  BlockPositions[DiscoveredCount] = BasePosition + DiscoveryPosition;
+  if( DiscoveredCount == Header.BlocksCount ) {
+    delete[] DiscoveryWindow;
+    DiscoveryWindow = Null;
+    DiscoveryWindowLength = 0;
+
+    // The next opens of the stream skip the discovery
+    if( IndexFileName ) {
+      SaveIndex( IndexFileName );
+      delete[] IndexFileName;
+      IndexFileName = Null;
+    }
+  }
+}
+
+void ZippedStreamReader::DiscoverBlock( const uint& blockID ) {
+  while( DiscoveredCount <= blockID && DiscoveredCount < Header.BlocksCount )
+    DiscoverNext();
+}
+
+void ZippedStreamReader::DiscoverBlocks( const ulong& position ) {
+  // Every block which starts at or before the position
+  while( DiscoveryOffset <= position && DiscoveredCount < Header.BlocksCount )
+    DiscoverNext();
+}
+
+ZippedBlockReader* ZippedStreamReader::CreateBlock( const uint& blockID ) {
+  // The block reads its header through the shared base stream
+  BaseStreamMutex.Enter();
+  ZippedBlockReader* block = Null;
+  try {
+    block = new ZippedBlockReader( BaseStream, BlockPositions[blockID], GetBlockExtensionSize(), Memory );
+  }
+  catch( ... ) {
+    BaseStreamMutex.Leave();
+    throw;
+  }
+
+  BaseStreamMutex.Leave();
+  block->SetAsyncFile( AsyncFile );
+  InitBlock( block );
+  block->SetVerification( Verification );
+  return block;
+}
+
+ZippedBlockReader* ZippedStreamReader::GetBlock( const uint& blockID ) {
+  auto block = (ZippedBlockReader*)Blocks[blockID];
+  if( block )
+    return block;
+
+  DiscoverBlock( blockID );
+  if( LiveBlocks.GetNum() >= LiveBlocksLimit )
+    ReleaseBlocks();
+
+  block = CreateBlock( blockID );
+  if( block->IsReference() ) {
+    uint referenceID = block->HeaderExtension.Reference;
+    if( referenceID >= blockID ) {
+      delete block;
+      ZIPASSERT( false, "Bad zipped block reference." );
+    }
+
+    block->SetReference( GetBlock( referenceID ) );
+  }
+
+  Blocks[blockID] = block;
+  LiveBlocks.Insert( blockID );
+  return block;
+}
+
+void ZippedStreamReader::ReleaseBlocks() {
+  // The references go first, so their blocks are released by the next pass
+  for( uint pass = 0; pass < 2; pass++ ) {
+    for( uint i = 0; i < LiveBlocks.GetNum(); i++ ) {
+      uint blockID = LiveBlocks[i];
+      auto block = (ZippedBlockReader*)Blocks[blockID];
+      if( block->IsLive() )
+        continue;
+
+      delete block;
+      Blocks[blockID] = Null;
+      LiveBlocks.FastRemoveAt( i-- );
+    }
+  }
+
+  LiveBlocksLimit = max( ZippedLiveBlocksMin, LiveBlocks.GetNum() * 2 );
+}
+
+bool ZippedStreamReader::GetIndexHeader( ZippedIndexHeader& header ) {
+  memset( &header, 0, sizeof( header ) );
+  if( !BaseStream || !ZippedIndex::GetFileStamp( BaseStream, header.FileSize, header.FileTime ) )
+    return false;
+
+  ulong headerSize = GetHeaderSize();
+  byte* data = new byte[headerSize];
+  ZippedMemory::ReadAt( BaseStream, Memory, data, BasePosition, headerSize );
+  header.StreamHash   = ZippedHash::Compute( data, headerSize );
+  header.BasePosition = BasePosition;
+  header.BlocksCount  = Header.BlocksCount;
+  delete[] data;
+  return true;
+}
+
+bool ZippedStreamReader::SetIndexFile( const char* fileName ) {
+  delete[] IndexFileName;
+  IndexFileName = Null;
+
+  ZippedIndexHeader header;
+  if( !GetIndexHeader( header ) )
+    return false;
+
+  uint blocksCount = Header.BlocksCount;
+  if( ZippedIndex::Load( fileName, header, BlockOffsets, BlockPositions, BlockLengths ) ) {
+    DiscoveredCount   = blocksCount;
+    DiscoveryOffset   = BlockOffsets[blocksCount];
+    DiscoveryPosition = BlockPositions[blocksCount] - BasePosition;
+    delete[] DiscoveryWindow;
+    DiscoveryWindow = Null;
+    DiscoveryWindowLength = 0;
+    return true;
+  }
+
+  // A missing or outdated index is written when the discovery ends
+  if( DiscoveredCount == blocksCount )
+    SaveIndex( fileName );
+  else {
+    IndexFileName = new char[strlen( fileName ) + 1];
+    strcpy( IndexFileName, fileName );
+  }
+
+  return false;
+}
+
+bool ZippedStreamReader::SaveIndex( const char* fileName ) {
+  DiscoverBlock( Header.BlocksCount - 1 );
+  ZippedIndexHeader header;
+  if( !GetIndexHeader( header ) )
+    return false;
+
+  return ZippedIndex::Save( fileName, header, BlockOffsets, BlockPositions, BlockLengths );
+}
+
+template <class T>
+static T* GrowTable( T* table, const uint& count, const uint& newCount ) {
+  T* newTable = new T[newCount];
+  memcpy( newTable, table, sizeof( T ) * count );
+  delete[] table;
+  return newTable;
+}
+
+uint ZippedStreamReader::Refresh() {
+  // The header is rewritten by the writer sync, a torn header
+  // fails its checksum and is left for later. The simple streams
+  // have no checksum, their header is read twice instead.
+  // The buffered data of the previous reads is dropped.
+  if( BaseStream )
+    fflush( BaseStream );
+
+  auto header = Header;
+  bool valid = false;
+  if( HasHeaderChecksum() ) {
+    ZippedStreamExtension extension;
+    memset( &extension, 0, sizeof( extension ) );
+    ulong extensionSize = min( Extension.Size, sizeof( extension ) );
+    byte* data = new byte[sizeof( header ) + extensionSize];
+    ZippedMemory::ReadAt( BaseStream, Memory, data, BasePosition, sizeof( header ) + extensionSize );
+    memcpy( &header, data, sizeof( header ) );
+    memcpy( &extension, data + sizeof( header ), extensionSize );
+    delete[] data;
+    valid = ComputeHeaderChecksum( &header, extension ) == extension.HeaderChecksum;
+  }
+  else {
+    auto check = Header;
+    ZippedMemory::ReadAt( BaseStream, Memory, &header, BasePosition, sizeof( header ) );
+    ZippedMemory::ReadAt( BaseStream, Memory, &check,  BasePosition, sizeof( check ) );
+    valid = memcmp( &header, &check, sizeof( header ) ) == 0;
+  }
+
+  uint count = Header.BlocksCount;
+  uint blocksCount = header.BlocksCount;
+  if( !valid || blocksCount <= count )
+    return count;
+
+  ZIPASSERT( header.Length >= Header.Length, "Bad zipped stream length." );
+  Blocks         = GrowTable( Blocks, count, blocksCount );
+  BlockOffsets   = GrowTable( BlockOffsets, count + 1, blocksCount + 1 );
+  BlockPositions = GrowTable( BlockPositions, count + 1, blocksCount + 1 );
+  BlockLengths   = GrowTable( BlockLengths, count, blocksCount );
+  for( uint i = count; i < blocksCount; i++ )
+    Blocks[i] = Null;
 
+  for( uint i = DiscoveredCount; i <= blocksCount; i++ )
+    BlockOffsets[i] = header.Length;
+
+  BlockPositions[blocksCount] = BasePosition + DiscoveryPosition;
+  Header.Length      = header.Length;
+  Header.BlocksCount = blocksCount;
+
+  // The window may hold the data written after it was read
+  delete[] DiscoveryWindow;
+  DiscoveryWindow = Null;
+  DiscoveryWindowLength = 0;
+  DiscoveryWindowSize   = 0;
+  return blocksCount;
+}
+
+uint ZippedStreamReader::Recover() {
+  uint count = Header.BlocksCount;
+  if( !(Extension.Flags & ZIPPED_STREAM_RECOVERY) )
+    return count;
+
+  // The chain continues after the blocks of the header
+  // while the framing and the checksums of the blocks match
+  DiscoverBlock( count - 1 );
+  Common::Array<ulong> positions;
+  Common::Array<ZippedBlockHeader> headers;
+  ulong length = Header.Length;
+  ulong position = DiscoveryPosition;
+  ulong lastLength = count > 0 ? Header.Length - BlockOffsets[count - 1] : Header.BlockSize;
+  for( uint blockID = count; ; blockID++ ) {
+    if( !IsChunked() && lastLength < Header.BlockSize )
+      break;
+
+    ulong blockPosition = AlignBlockOffset( position );
+    ZippedBlockReader block( BaseStream, BasePosition + blockPosition, GetBlockExtensionSize(), Memory );
+    ulong lengthSource = block.Header.LengthSource;
+    ulong lengthCompressed = block.Header.LengthCompressed;
+    if( !block.VerifyFrame( blockID ) || lengthSource == 0 || lengthSource > Header.BlockSize || lengthCompressed > compressBound( Header.BlockSize ) )
+      break;
+
+    if( block.IsReference() && block.HeaderExtension.Reference >= blockID )
+      break;
+
+    if( block.HasPayload() ) {
+      byte* data = new byte[lengthCompressed];
+      bool intact = block.ReadCompressed( data, BaseStreamMutex ) == lengthCompressed && block.HasChecksum() && block.VerifyCompressed( data, lengthCompressed );
+      delete[] data;
+      if( !intact )
+        break;
+    }
+
+    positions.Insert( blockPosition );
+    headers.Insert( block.Header );
+    length    += lengthSource;
+    position   = blockPosition + block.GetFileSize();
+    lastLength = lengthSource;
+  }
+
+  uint blocksCount = count + positions.GetNum();
+  if( blocksCount == count )
+    return count;
+
+  Blocks         = GrowTable( Blocks, count, blocksCount );
+  BlockOffsets   = GrowTable( BlockOffsets, count + 1, blocksCount + 1 );
+  BlockPositions = GrowTable( BlockPositions, count + 1, blocksCount + 1 );
+  BlockLengths   = GrowTable( BlockLengths, count, blocksCount );
+  Header.Length      = length;
+  Header.BlocksCount = blocksCount;
+  for( uint i = 0; i < positions.GetNum(); i++ ) {
+    uint blockID = count + i;
+    Blocks[blockID]         = Null;
+    BlockOffsets[blockID]   = DiscoveryOffset;
+    BlockPositions[blockID] = BasePosition + positions[i];
+    BlockLengths[blockID]   = headers[i].LengthCompressed;
+    DiscoveryOffset += headers[i].LengthSource;
+  }
+
+  BlockOffsets[blocksCount]   = length;
+  BlockPositions[blocksCount] = BasePosition + position;
+  DiscoveredCount   = blocksCount;
+  DiscoveryPosition = position;
+  return blocksCount;
+}
+
+uint ZippedStreamReader::GetLiveBlocksCount() {
+  return LiveBlocks.GetNum();
+}
+
+ulong ZippedStreamReader::GetStreamSize() {
+  DiscoverBlock( Header.BlocksCount - 1 );
+  return BlockPositions[Header.BlocksCount] - BasePosition;
+}
+
+void ZippedStreamReader::GetBlockInfo( const uint& blockID, ZippedBlockInfo& info ) {
+  ZIPASSERT( blockID < Header.BlocksCount, "Zipped block ID is out of range." );
+  DiscoverBlock( blockID );
+  auto block = CreateBlock( blockID );
+  info.Position         = BlockOffsets[blockID];
+  info.FilePosition     = BlockPositions[blockID];
+  info.FileSize         = block->GetFileSize();
+  info.LengthSource     = block->Header.LengthSource;
+  info.LengthCompressed = BlockLengths[blockID];
+  info.Flags            = block->HeaderExtension.Flags;
+  info.Reference        = block->HeaderExtension.Reference;
+  info.Filter           = block->HeaderExtension.Filter;
+  delete block;
+}
+
+bool ZippedStreamReader::SetReadBlock() {
+  // Block transition, the only place of the lookup and the read-ahead
+  Release( ReadView );
+  ReadPointer = Null;
+  ReadEnd     = Null;
+  if( Position >= (long&)Header.Length )
+    return false;
+
+  DiscoverBlocks( Position );
+  ReadPosition = BlockOffsets[FindBlock( Position )];
+  if( !Borrow( ReadPosition, Invalid, ReadView ) )
+    return false;
+
+  // The views of the fill blocks are shorter than the blocks
+  if( (ulong)Position - ReadPosition >= ReadView.Length ) {
+    Release( ReadView );
+    ReadPosition = Position;
+    if( !Borrow( ReadPosition, Invalid, ReadView ) )
+      return false;
+  }
+
+  ReadPointer = ReadView.Data + (Position - ReadPosition);
+  ReadEnd     = ReadView.Data + ReadView.Length;
+  return true;
+}
+
+void ZippedStreamReader::ReadAhead( const uint& blockID ) {
   uint cachedCount = blockID + ZIPPED_THREADS_COUNT;
   uint blockCount  = Header.BlocksCount;
   for( uint i = blockID + 1; i <= cachedCount && i < blockCount; i++ )
-    Blocks[i]->CacheIn();
+    GetBlock( i )->CacheIn();
+}
 
-  return block;
+bool ZippedStreamReader::Borrow( const ulong& position, const ulong& length, ZippedView& view ) {
+  // The view ends at the end of the block, the stream position is not changed
+  if( position >= Header.Length ) {
+    view.Data   = Null;
+    view.Length = 0;
+    view.Block  = Null;
+    return false;
+  }
+
+  DiscoverBlocks( position );
+  uint blockID = FindBlock( position );
+  auto block = GetBlock( blockID );
+  bool borrowed = block->Borrow( position - BlockOffsets[blockID], length, view );
+  ReadAhead( blockID );
+  return borrowed;
+}
+
+void ZippedStreamReader::Release( ZippedView& view ) {
+  if( view.Block )
+    view.Block->Unpin();
+
+  view.Data   = Null;
+  view.Length = 0;
+  view.Block  = Null;
+}
+
+long ZippedStreamReader::Seek( const long& offset, const uint& origin ) {
+  ZippedStreamBase::Seek( offset, origin );
+
+  // The current block is kept, the next read outside of it changes the block
+  ulong blockPosition = Position - ReadPosition;
+  if( ReadView.Block && (ulong)Position >= ReadPosition && blockPosition < ReadView.Length ) {
+    ReadPointer = ReadView.Data + blockPosition;
+    ReadEnd     = ReadView.Data + ReadView.Length;
+  }
+  else {
+    ReadPointer = Null;
+    ReadEnd     = Null;
+  }
+
+  return Position;
 }
 
 ulong ZippedStreamReader::Read( byte* buffer, const ulong& length ) {
-  if( length == 0 )
-    return 0;
+  // Fast path of the reads inside the current block
+  if( length <= (ulong)(ReadEnd - ReadPointer) ) {
+    memcpy( buffer, ReadPointer, length );
+    ReadPointer += length;
+    Position    += length;
+    return length;
+  }
 
-  ulong toRead = length;
+  return ReadBlocks( buffer, length );
+}
+
+ulong ZippedStreamReader::ReadBlocks( byte* buffer, const ulong& length ) {
   ulong readedTotal = 0;
-  while( toRead > 0 ) {
-    auto block = GetBlockToRead();
-    ulong readed = block->Read( buffer, toRead );
-    if( readed == 0 )
+  while( readedTotal < length ) {
+    if( ReadPointer == ReadEnd && !SetReadBlock() )
       break;
 
-    buffer += readed;
-    toRead -= readed;
-    Position += readed;
+    ulong readed = min( length - readedTotal, (ulong)(ReadEnd - ReadPointer) );
+    memcpy( buffer + readedTotal, ReadPointer, readed );
+    ReadPointer += readed;
+    Position    += readed;
     readedTotal += readed;
   }
 
@@ -170,13 +1175,74 @@ ulong ZippedStreamReader::Write( byte* buffer, const ulong& length ) {
 bool ZippedStreamReader::EndOfFile() {
   return Position >= (long&)Header.Length;
 }
+
+bool ZippedStreamReader::SetDirectIO( const bool& enabled ) {
+  // The handle is replaced when no block is loading
+  for( uint i = 0; i < LiveBlocks.GetNum(); i++ )
+    Blocks[LiveBlocks[i]]->Buffer.WaitForDecompress();
+
+  if( !BaseStream )
+    return false;
+
+  auto& asyncIO = ZippedAsyncIO::GetInstance();
+  ZippedAsyncFile* asyncFile = asyncIO.Open( BaseStream, enabled );
+  if( !asyncFile )
+    return false;
+
+  if( AsyncFile )
+    asyncIO.Close( AsyncFile );
+
+  AsyncFile = asyncFile;
+  for( uint i = 0; i < LiveBlocks.GetNum(); i++ )
+    ((ZippedBlockReader*)Blocks[LiveBlocks[i]])->SetAsyncFile( AsyncFile );
+
+  return true;
+}
+
+ZippedStreamReader::~ZippedStreamReader() {
+  Release( ReadView );
+
+  // The pending reads use the private handle
+  for( uint i = 0; i < LiveBlocks.GetNum(); i++ )
+    Blocks[LiveBlocks[i]]->Buffer.WaitForDecompress();
+
+  if( AsyncFile )
+    ZippedAsyncIO::GetInstance().Close( AsyncFile );
+
+  // The references are deleted before their blocks
+  for( uint i = Header.BlocksCount; i > 0; i-- ) {
+    delete Blocks[i - 1];
+    Blocks[i - 1] = Null;
+  }
+
+  delete[] BlockPositions;
+  delete[] BlockLengths;
+  delete[] DiscoveryWindow;
+  delete[] IndexFileName;
+}
 #pragma endregion
 
 
 
 #pragma region writer
 ZippedStreamWriter::ZippedStreamWriter( FILE* baseStream, long position ) : ZippedStreamBase( baseStream, position ) {
+  Init();
+}
+
+ZippedStreamWriter::ZippedStreamWriter( ZippedMemory* memory ) : ZippedStreamBase( memory ) {
+  ZIPASSERT( !memory->IsReadOnly(), "Can not write a zipped stream into the external zipped memory." );
+  Init();
+}
+
+void ZippedStreamWriter::Init() {
   LengthCompressed = 0;
+  StreamSize       = 0;
+  FirstBlock       = 0;
+  AppendedLength   = 0;
+  OutputPosition   = 0;
+  Finished         = false;
+  Filter           = 0;
+  Level            = Z_DEFAULT_COMPRESSION;
 }
 
 long ZippedStreamWriter::Seek( const long& offset, const uint& origin ) {
@@ -184,43 +1250,417 @@ long ZippedStreamWriter::Seek( const long& offset, const uint& origin ) {
   return ZippedStreamBase::Seek( offset, origin );
 }
 
+void ZippedStreamWriter::SetDictionary( byte* buffer, const ulong& length ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream dictionary after start of writing." );
+  ZippedStreamBase::SetDictionary( buffer, length );
+}
+
+void ZippedStreamWriter::SetDeduplication( const bool& enabled ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream deduplication after start of writing." );
+  if( enabled )
+    Extension.Flags |= ZIPPED_STREAM_DEDUPLICATION;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_DEDUPLICATION;
+}
+
+void ZippedStreamWriter::SetFillDetection( const bool& enabled ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream fill detection after start of writing." );
+  if( enabled )
+    Extension.Flags |= ZIPPED_STREAM_FILL;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_FILL;
+}
+
+void ZippedStreamWriter::SetChunking( const ulong& minSize, const ulong& averageSize, const ulong& maxSize ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream chunking after start of writing." );
+  Chunker.SetSizes( minSize, averageSize, maxSize );
+  Header.BlockSize = maxSize;
+  Extension.Flags |= ZIPPED_STREAM_CHUNKED;
+}
+
+void ZippedStreamWriter::SetFilter( const ulong& filter, const uint& elementSize ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream filter after start of writing." );
+  Filter = filter ? ZippedKernels::MakeFilter( filter, elementSize ) : 0;
+  if( Filter )
+    Extension.Flags |= ZIPPED_STREAM_FILTER;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_FILTER;
+}
+
+void ZippedStreamWriter::SetChecksums( const bool& enabled ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream checksums after start of writing." );
+  if( enabled )
+    Extension.Flags |= ZIPPED_STREAM_CHECKSUM;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_CHECKSUM;
+}
+
+void ZippedStreamWriter::SetLevel( const int& level ) {
+  ZIPASSERT( level == Z_DEFAULT_COMPRESSION || (level >= Z_NO_COMPRESSION && level <= Z_BEST_COMPRESSION), "Invalid zipped stream compression level." );
+  Level = level;
+}
+
+void ZippedStreamWriter::SetRecovery( const bool& enabled ) {
+  // The recovery scan checks the data by the checksums
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream recovery after start of writing." );
+  if( enabled )
+    Extension.Flags |= ZIPPED_STREAM_RECOVERY | ZIPPED_STREAM_CHECKSUM;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_RECOVERY;
+}
+
+void ZippedStreamWriter::SetStreaming( const bool& enabled ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream streaming after start of writing." );
+  if( enabled )
+    Extension.Flags |= ZIPPED_STREAM_TRAILER;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_TRAILER;
+}
+
+bool ZippedStreamWriter::IsStreaming() {
+  return (Extension.Flags & ZIPPED_STREAM_TRAILER) != 0;
+}
+
+void ZippedStreamWriter::SetBlockAlignment( const ulong& alignment ) {
+  ZIPASSERT( Header.BlocksCount == 0, "Can not change a zipped stream block alignment after start of writing." );
+  Extension.BlockAlignment = alignment > 1 ? alignment : 0;
+  if( Extension.BlockAlignment )
+    Extension.Flags |= ZIPPED_STREAM_ALIGNED;
+  else
+    Extension.Flags &= ~ZIPPED_STREAM_ALIGNED;
+}
+
+void ZippedStreamWriter::Append() {
+  ZIPASSERT( Header.BlocksCount == 0 && Header.Length == 0, "Can not append to a zipped stream after start of writing." );
+
+  // The settings of the stream replace the writer settings
+  delete[] Dictionary;
+  Dictionary = Null;
+  Filter = 0;
+  memset( &Extension, 0, sizeof( Extension ) );
+  Extension.Signature          = ZippedExtensionSignature;
+  Extension.Size               = sizeof( Extension );
+  Extension.BlockExtensionSize = sizeof( ZippedBlockExtension );
+  ReadHeader();
+  ZIPASSERT( Extension.Size <= sizeof( Extension ), "Can not append to a zipped stream of a newer version." );
+  ZIPASSERT( !IsStreaming(), "Can not append to a streamed zipped stream." );
+  ZIPASSERT( GetBlockExtensionSize() <= sizeof( ZippedBlockExtension ), "Can not append to a zipped stream of a newer version." );
+  uint blocksCount = Header.BlocksCount;
+  Header.BlocksCount = 0;
+  if( blocksCount == 0 && !(Extension.Flags & ZIPPED_STREAM_RECOVERY) ) {
+    Header.Length = 0;
+    return;
+  }
+
+  // A stream which was not closed continues
+  // after its last intact block
+  ZippedStreamReader* reader = Memory ?
+    new ZippedStreamReader( Memory ) :
+    new ZippedStreamReader( BaseStream, BasePosition );
+
+  blocksCount   = reader->Recover();
+  Header.Length = reader->GetLength();
+  if( blocksCount == 0 ) {
+    reader->Close( false );
+    return;
+  }
+
+  // New blocks take the filter of the last data block
+  ZippedBlockInfo info;
+  for( uint i = blocksCount; i > 0; i-- ) {
+    reader->GetBlockInfo( i - 1, info );
+    if( !(info.Flags & (ZIPPED_BLOCK_REFERENCE | ZIPPED_BLOCK_FILL)) ) {
+      Filter = info.Filter;
+      break;
+    }
+  }
+
+  if( IsChunked() && Chunker.GetMaxSize() != Header.BlockSize )
+    Chunker.SetSizes( Header.BlockSize / 4, Header.BlockSize / 2, Header.BlockSize );
+
+  // A full last block stays as is. A partial one is
+  // rewritten at its place together with the new data
+  byte* lastData = Null;
+  ulong lastLength = 0;
+  reader->GetBlockInfo( blocksCount - 1, info );
+  if( IsChunked() || info.LengthSource == Header.BlockSize ) {
+    StreamSize = reader->GetStreamSize();
+    FirstBlock = blocksCount;
+  }
+  else {
+    lastLength = info.LengthSource;
+    lastData = new byte[lastLength];
+    reader->Seek( info.Position );
+    ulong readed = reader->Read( lastData, lastLength );
+    StreamSize = info.FilePosition - BasePosition;
+    FirstBlock = blocksCount - 1;
+    if( readed != lastLength ) {
+      delete[] lastData;
+      reader->Close( false );
+      ZIPASSERT( false, "Can not read the last block of the appended zipped stream." );
+    }
+  }
+
+  reader->Close( false );
+  if( FirstBlock > 0 ) {
+    Blocks = (ZippedBlockBase**)shi_malloc( FirstBlock * sizeof( ZippedBlockBase* ) );
+    memset( Blocks, 0, FirstBlock * sizeof( ZippedBlockBase* ) );
+  }
+
+  Header.BlocksCount = FirstBlock;
+  Header.Length      = FirstBlock < blocksCount ? info.Position : Header.Length;
+  Position           = Header.Length;
+
+  // The header stops before the rewritten block, so a
+  // crash during the append loses only the new data
+  if( Extension.Flags & ZIPPED_STREAM_RECOVERY ) {
+    WriteHeader( Header.Length, FirstBlock );
+    FlushBaseStream();
+  }
+
+  if( lastData ) {
+    Write( lastData, lastLength );
+    delete[] lastData;
+  }
+
+  AppendedLength = Header.Length;
+}
+
+ulong ZippedStreamWriter::GetStreamSize() {
+  // The blocks are flushed in order, so the flushes keep the size
+  return StreamSize ? StreamSize : GetHeaderSize();
+}
+
+bool ZippedStreamWriter::CompressBlock( const uint& blockID, const bool& clearSource ) {
+  // Blocks of the appended stream are already written
+  return blockID < FirstBlock || ZippedStreamBase::CompressBlock( blockID, clearSource );
+}
+
+bool ZippedStreamWriter::DecompressBlock( const uint& blockID, const bool& clearCompressed ) {
+  // Blocks of the appended stream are not loaded
+  return blockID < FirstBlock || ZippedStreamBase::DecompressBlock( blockID, clearCompressed );
+}
+
 void ZippedStreamWriter::CommitHeader() {
-  fseek( BaseStream, BasePosition, SEEK_SET );
-  fwrite( &Header, 1, sizeof( Header ), BaseStream );
-  fseek( BaseStream, BasePosition + GetStreamSize(), SEEK_SET );
+  WriteHeader( Header.Length, Header.BlocksCount );
+  if( IsStreaming() ) {
+    WriteTrailer();
+    return;
+  }
+
+  // The file is left at the end of the stream
+  if( BaseStream )
+    fseek( BaseStream, BasePosition + GetStreamSize(), SEEK_SET );
+}
+
+void ZippedStreamWriter::WriteHeader( const ulong& length, const uint& blocksCount ) {
+  // The streamed header is written once before the blocks
+  if( IsStreaming() && OutputPosition > 0 )
+    return;
+
+  auto header = Header;
+  header.Length      = IsStreaming() ? 0 : length;
+  header.BlocksCount = IsStreaming() ? 0 : blocksCount;
+  if( IsExtended() )
+    header.BlockSize |= ZippedHeaderExtended;
+
+  if( !IsExtended() ) {
+    WriteOut( &header, 0, sizeof( header ) );
+    return;
+  }
+
+  // The header and the extension go by one write and the checksum
+  // covers both, so the readers find a header torn by the sync.
+  // An appended stream keeps the extension size of its writer
+  if( HasHeaderChecksum() )
+    Extension.HeaderChecksum = ComputeHeaderChecksum( &header, Extension );
+
+  byte* buffer = new byte[sizeof( header ) + Extension.Size];
+  memcpy( buffer, &header, sizeof( header ) );
+  memcpy( buffer + sizeof( header ), &Extension, Extension.Size );
+  WriteOut( buffer, 0, sizeof( header ) + Extension.Size );
+  delete[] buffer;
+  WriteOut( Dictionary, sizeof( header ) + Extension.Size, Extension.DictionaryLength );
+}
+
+void ZippedStreamWriter::WriteTrailer() {
+  if( Finished )
+    return;
+
+  // The chain ends with an empty block header
+  uint blocksCount = Header.BlocksCount;
+  ulong end = GetStreamSize();
+  ulong position = AlignBlockOffset( end );
+  ZippedBlockHeader blockHeader;
+  memset( &blockHeader, 0, sizeof( blockHeader ) );
+  WriteOut( &blockHeader, position, sizeof( blockHeader ) );
+  position += sizeof( blockHeader );
+
+  ulong* index = new ulong[blocksCount * 3 + 2];
+  ulong* offsets   = index;
+  ulong* positions = index + blocksCount + 1;
+  ulong* lengths   = index + blocksCount * 2 + 2;
+  ulong offset = 0;
+  for( uint i = 0; i < blocksCount; i++ ) {
+    auto block = Blocks[i];
+    offsets[i]   = offset;
+    positions[i] = block->BasePosition - BasePosition;
+    lengths[i]   = block->Header.LengthCompressed;
+    offset += block->Header.LengthSource;
+  }
+
+  offsets[blocksCount]   = offset;
+  positions[blocksCount] = end;
+
+  ZippedStreamTrailer trailer;
+  trailer.Signature     = ZippedTrailerSignature;
+  trailer.Length        = Header.Length;
+  trailer.BlocksCount   = blocksCount;
+  trailer.IndexPosition = position;
+  ulong indexSize = sizeof( ulong ) * (blocksCount * 3 + 2);
+  WriteOut( index, position, indexSize );
+  WriteOut( &trailer, position + indexSize, sizeof( trailer ) );
+  delete[] index;
+  FlushBaseStream();
+  Finished = true;
+}
+
+void ZippedStreamWriter::WriteOut( const void* buffer, const ulong& position, const ulong& length ) {
+  if( length == 0 )
+    return;
+
+  if( !IsStreaming() || Memory )
+    ZippedMemory::WriteAt( BaseStream, Memory, buffer, BasePosition + position, length );
+  else {
+    // The sink can not seek, so the gaps before
+    // the aligned blocks are written as zeros
+    static const byte zeros[256] = { 0 };
+    ZIPASSERT( position >= OutputPosition, "Can not seek back in the streamed zipped stream." );
+    while( OutputPosition < position ) {
+      ulong gap = min( position - OutputPosition, sizeof( zeros ) );
+      ZIPASSERT( fwrite( zeros, 1, gap, BaseStream ) == gap, "Can not write the streamed zipped stream." );
+      OutputPosition += gap;
+    }
+
+    ZIPASSERT( fwrite( buffer, 1, length, BaseStream ) == length, "Can not write the streamed zipped stream." );
+  }
+
+  OutputPosition = max( OutputPosition, position + length );
+}
+
+void ZippedStreamWriter::FlushBaseStream() {
+  if( !BaseStream )
+    return;
+
+  // The pipes are not flushed to the disk
+  fflush( BaseStream );
+  if( !IsStreaming() )
+    FlushFileBuffers( (HANDLE)_get_osfhandle( _fileno( BaseStream ) ) );
 }
 
 void ZippedStreamWriter::CommitData() {
-  for( uint i = 0; i < Header.BlocksCount; i++ )
-    FlushBlock( Blocks[i] );
+  for( uint i = FirstBlock; i < Header.BlocksCount; i++ )
+    FlushBlock( i );
 }
 
 ulong ZippedStreamWriter::Read( byte* buffer, const ulong& length ) {
   throw std::exception( "Can not read a zipped file from the write-only object." );
 }
 
-void ZippedStreamWriter::FlushBlock( ZippedBlockBase* block ) {
+void ZippedStreamWriter::FlushBlock( const uint& blockID ) {
+  auto block = Blocks[blockID];
   if( block->Cached() )
     return;
 
-  block->BasePosition = BasePosition + GetStreamSize();
-  block->Compress();
-  block->CacheIn();
+  ulong position = AlignBlockOffset( GetStreamSize() );
+  block->BasePosition = BasePosition + position;
+  if( !((ZippedBlockWriter*)block)->CommitFill() && !DeduplicateBlock( blockID ) )
+    block->Compress();
+
+  // The header and the data go to the base stream by one write
+  ulong fileSize = sizeof( block->Header ) + GetBlockExtensionSize() + block->Header.LengthCompressed;
+  byte* buffer = new byte[fileSize];
+  ((ZippedBlockWriter*)block)->CommitTo( buffer );
+  WriteOut( buffer, position, fileSize );
+  delete[] buffer;
+  StreamSize = position + fileSize;
+}
+
+bool ZippedStreamWriter::DeduplicateBlock( const uint& blockID ) {
+  if( !(Extension.Flags & ZIPPED_STREAM_DEDUPLICATION) )
+    return false;
+
+  auto& source = Blocks[blockID]->Buffer.Source;
+  return DeduplicateBlock( blockID, ZippedHash::Compute( source.GetBuffer(), source.GetLength() ), source.GetBuffer() );
+}
+
+bool ZippedStreamWriter::DeduplicateBlock( const uint& blockID, const ZippedHash& hash, const byte* source, const ZippedBatchContext* batch ) {
+  auto block = (ZippedBlockWriter*)Blocks[blockID];
+  uint referenceID = Fingerprints.Find( hash );
+  if( referenceID == Invalid ) {
+    Fingerprints.Insert( hash, blockID );
+    return false;
+  }
+
+  // The fingerprint only finds the candidate, a collision
+  // must not put the data of another block into the stream
+  if( !MatchBlock( referenceID, source, block->Header.LengthSource, batch ) )
+    return false;
+
+  block->SetReference( referenceID );
+  return true;
+}
+
+ZippedBlockWriter* ZippedStreamWriter::CreateBlock( const uint& blockID ) {
+  // The block header format can not change after the first block
+  if( blockID == 0 )
+    Extension.BlockExtensionSize = sizeof( ZippedBlockExtension );
+
+  // The recoverable and the streamed streams
+  // have the header before their blocks
+  if( blockID == 0 && (Extension.Flags & (ZIPPED_STREAM_RECOVERY | ZIPPED_STREAM_TRAILER)) )
+    WriteHeader( 0, 0 );
+
+  auto block = new ZippedBlockWriter( BaseStream, 0, GetBlockExtensionSize(), Memory );
+  block->SetBlockSize( Header.BlockSize );
+  block->SetSequence( blockID );
+  block->SetFillDetection( (Extension.Flags & ZIPPED_STREAM_FILL) != 0 );
+  block->SetFilter( Filter );
+  block->SetLevel( Level );
+  block->SetChecksums( (Extension.Flags & ZIPPED_STREAM_CHECKSUM) != 0 );
+  InitBlock( block );
+
+  // The blockID may refer to BlocksCount, so it is incremented last
+  Blocks = (ZippedBlockBase**)shi_realloc( Blocks, (Header.BlocksCount + 1) * sizeof( ZippedBlockBase* ) );
+  Blocks[blockID] = block;
+  Header.BlocksCount++;
+  return block;
 }
 
 ZippedBlockBase* ZippedStreamWriter::GetBlockToWrite() {
-  uint blockID = Position / Header.BlockSize;
-  uint blockPosition = Position - blockID * Header.BlockSize;
+  uint blockID;
+  uint blockPosition;
+  if( IsChunked() ) {
+    // A new chunk starts after the boundary found by the chunker
+    bool newChunk = Header.BlocksCount == FirstBlock || Chunker.IsFinished() || Blocks[Header.BlocksCount - 1]->Cached();
+    blockID = newChunk ? Header.BlocksCount : Header.BlocksCount - 1;
+    blockPosition = newChunk ? 0 : Blocks[blockID]->Header.LengthSource;
+    if( newChunk )
+      Chunker.Reset();
+  }
+  else {
+    blockID = Position / Header.BlockSize;
+    blockPosition = Position - blockID * Header.BlockSize;
+  }
+
   if( blockID >= Header.BlocksCount ) {
     ZIPASSERT( blockID == Header.BlocksCount, "Can not create a far zipped writer block." );
-    Blocks = (ZippedBlockBase**)shi_realloc( Blocks, ++Header.BlocksCount * 4 );
-    Blocks[blockID] = new ZippedBlockWriter( BaseStream );
-    Blocks[blockID]->SetBlockSize( Header.BlockSize );
-
-    if( blockID > 0 )
-      FlushBlock( Blocks[blockID - 1] );
+    CreateBlock( blockID );
+    if( blockID > FirstBlock )
+      FlushBlock( blockID - 1 );
   }
 
+  ZIPASSERT( !Blocks[blockID]->Cached(), "Can not write into the flushed zipped block." );
   Blocks[blockID]->Seek( blockPosition );
   return Blocks[blockID];
 }
@@ -233,7 +1673,11 @@ ulong ZippedStreamWriter::Write( byte* buffer, const ulong& length ) {
   ulong writedTotal = 0;
   while( toWrite > 0 ) {
     auto block = GetBlockToWrite();
-    ulong writed = block->Write( buffer, toWrite );
+    ulong toBlock = IsChunked() ?
+      Chunker.Scan( buffer, toWrite, block->Header.LengthSource ) :
+      toWrite;
+
+    ulong writed = block->Write( buffer, toBlock );
     ZIPASSERT( writed > 0, "Bad write operation. Return value can not be Zero." );
 
     buffer += writed;
@@ -250,11 +1694,247 @@ bool ZippedStreamWriter::EndOfFile() {
   return false;
 }
 
+struct ZippedBatchContext {
+  ZippedStreamWriter* Stream;
+  const byte* View;
+  const ulong* Offsets; // Block positions in the View
+  uint FirstBlock;
+  ZippedHash* Hashes;
+};
+
+bool ZippedStreamWriter::MatchBlock( const uint& referenceID, const byte* source, const ulong& length, const ZippedBatchContext* batch ) {
+  auto reference = Blocks[referenceID];
+  if( reference->Header.LengthSource != length )
+    return false;
+
+  // The blocks of the current batch are in its view
+  if( batch && referenceID >= batch->FirstBlock )
+    return memcmp( batch->View + batch->Offsets[referenceID - batch->FirstBlock], source, length ) == 0;
+
+  // The flushed block is read back and inflated,
+  // the streamed writers can not read their sink
+  if( IsStreaming() && !Memory )
+    return false;
+
+  ulong size = reference->Header.LengthCompressed;
+  byte* data = new byte[size];
+  ulong readed = ZippedMemory::ReadAt( BaseStream, Memory, data, reference->BasePosition + sizeof( reference->Header ) + GetBlockExtensionSize(), size );
+
+  ZippedBuffer buffer;
+  buffer.LengthMax = length;
+  buffer.SetDictionary( Dictionary, Extension.DictionaryLength );
+  buffer.SetFilter( reference->HeaderExtension.Filter );
+  buffer.SetVerification( true );
+  buffer.Compressed.SetBuffer( data, readed );
+  buffer.Decompress( false );
+  return
+    !buffer.Corrupted &&
+    buffer.Source.GetLength() == length &&
+    memcmp( buffer.Source.GetBuffer(), source, length ) == 0;
+}
+
+void ZippedStreamWriter::PrepareTask( void* context, const uint& index ) {
+  auto& batch = *(ZippedBatchContext*)context;
+  auto block = (ZippedBlockWriter*)batch.Stream->Blocks[batch.FirstBlock + index];
+  const byte* source = batch.View + batch.Offsets[index];
+  if( !block->CommitFill( source ) && batch.Hashes )
+    batch.Hashes[index] = ZippedHash::Compute( source, block->Header.LengthSource );
+}
+
+void ZippedStreamWriter::CompressBatchTask( void* context, const uint& index ) {
+  auto& batch = *(ZippedBatchContext*)context;
+  auto block = (ZippedBlockWriter*)batch.Stream->Blocks[batch.FirstBlock + index];
+  if( block->HasPayload() )
+    block->CompressFrom( batch.View + batch.Offsets[index], block->Header.LengthSource );
+}
+
+void ZippedStreamWriter::CompressBatch( const byte* view, const ulong* offsets, const uint& firstBlock, const uint& count ) {
+  ZippedBatchContext batch;
+  batch.Stream     = this;
+  batch.View       = view;
+  batch.Offsets    = offsets;
+  batch.FirstBlock = firstBlock;
+  batch.Hashes     = Extension.Flags & ZIPPED_STREAM_DEDUPLICATION ? new ZippedHash[count] : Null;
+
+  // Fill detection and fingerprints go in parallel, the references
+  // are resolved in order, so the result matches the Write path
+  uint threadsCount = GetParallelThreadsCount();
+  ZippedParallel::For( count, &PrepareTask, &batch, threadsCount );
+  if( batch.Hashes ) {
+    for( uint i = 0; i < count; i++ )
+      if( Blocks[firstBlock + i]->HasPayload() )
+        DeduplicateBlock( firstBlock + i, batch.Hashes[i], view + offsets[i], &batch );
+
+    delete[] batch.Hashes;
+  }
+
+  ZippedParallel::For( count, &CompressBatchTask, &batch, threadsCount );
+
+  // The whole batch goes to the base stream by one write
+  ulong position = GetStreamSize();
+  ulong batchSize = 0;
+  for( uint i = 0; i < count; i++ )
+    batchSize = AlignBlockOffset( position + batchSize ) - position + sizeof( Blocks[firstBlock + i]->Header ) + GetBlockExtensionSize() + Blocks[firstBlock + i]->Header.LengthCompressed;
+
+  byte* buffer = new byte[batchSize];
+  ulong offset = 0;
+  for( uint i = 0; i < count; i++ ) {
+    // Padding before the aligned blocks is zeroed
+    auto block = (ZippedBlockWriter*)Blocks[firstBlock + i];
+    ulong blockOffset = AlignBlockOffset( position + offset ) - position;
+    memset( buffer + offset, 0, blockOffset - offset );
+    block->BasePosition = BasePosition + position + blockOffset;
+    offset = blockOffset + block->CommitTo( buffer + blockOffset );
+  }
+
+  WriteOut( buffer, position, batchSize );
+  StreamSize = position + batchSize;
+  delete[] buffer;
+}
+
+ulong ZippedStreamWriter::CompressFile( const char* fileName ) {
+  HANDLE file = CreateFile( fileName, GENERIC_READ, FILE_SHARE_READ, Null, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, Null );
+  ZIPASSERT( file != INVALID_HANDLE_VALUE, "Can not open the file to compress." );
+  ulong length = CompressFile( file );
+  CloseHandle( file );
+  return length;
+}
+
+ulong ZippedStreamWriter::CompressFile( HANDLE file ) {
+  ZIPASSERT( Header.Length == AppendedLength, "Can not compress a file after start of writing." );
+  LARGE_INTEGER fileSize;
+  ZIPASSERT( GetFileSizeEx( file, &fileSize ), "Can not get the size of the file to compress." );
+  ZIPASSERT( fileSize.QuadPart <= 0xFFFFFFFF, "Can not compress a file larger than 4 GB." );
+  ulong length = (ulong)fileSize.QuadPart;
+  if( length == 0 )
+    return 0;
+
+  HANDLE mapping = CreateFileMapping( file, Null, PAGE_READONLY, 0, 0, Null );
+  ZIPASSERT( mapping != Null, "Can not map the file to compress." );
+
+  // The file is mapped by the batches of blocks, so the
+  // address space of x32 applications is not exhausted
+  SYSTEM_INFO info;
+  GetSystemInfo( &info );
+  ulong batchLength = max( Header.BlockSize, PARALLEL_MEMORY_LIMIT / 4 );
+  ulong blockSizeMin = IsChunked() ? max( Chunker.GetMinSize(), 1ul ) : Header.BlockSize;
+  ulong* offsets = new ulong[batchLength / blockSizeMin + 2];
+  ulong batchStart = 0;
+
+  try {
+    // The partial last block of the appended stream is filled first
+    if( Header.BlocksCount > FirstBlock ) {
+      auto block = Blocks[Header.BlocksCount - 1];
+      ulong headLength = min( length, Header.BlockSize - block->Header.LengthSource );
+      byte* view = (byte*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, headLength );
+      ZIPASSERT( view != Null, "Can not map the file to compress." );
+      Write( view, headLength );
+      UnmapViewOfFile( view );
+      if( block->Header.LengthSource == Header.BlockSize )
+        FlushBlock( Header.BlocksCount - 1 );
+
+      batchStart = headLength;
+    }
+
+    // The last partial block stays open like after Write, so
+    // more data can be written after the file. The chunk cut
+    // by the end of the file is found by the chunker below
+    ulong tailLength = IsChunked() ? 0 : (length - batchStart) % Header.BlockSize;
+    ulong bodyLength = length - tailLength;
+    while( batchStart < bodyLength ) {
+      ulong batchEnd = batchStart;
+      uint count = 0;
+      if( IsChunked() ) {
+        // Chunk boundaries need the data, so the view is mapped first
+        ulong viewStart = batchStart - batchStart % info.dwAllocationGranularity;
+        ulong viewLength = min( length - batchStart, batchLength + Header.BlockSize );
+        ulong viewEnd = batchStart + viewLength;
+        byte* view = (byte*)MapViewOfFile( mapping, FILE_MAP_READ, 0, viewStart, viewEnd - viewStart );
+        ZIPASSERT( view != Null, "Can not map the file to compress." );
+        while( batchEnd < viewEnd && (batchEnd - batchStart < batchLength || batchEnd == batchStart) ) {
+          Chunker.Reset();
+          ulong chunkLength = Chunker.Scan( view + (batchEnd - viewStart), viewEnd - batchEnd, 0 );
+          if( batchEnd + chunkLength == length && !Chunker.IsFinished() ) {
+            tailLength = chunkLength;
+            bodyLength = batchEnd;
+            break;
+          }
+
+          offsets[count] = batchEnd - viewStart;
+          CreateBlock( Header.BlocksCount )->Header.LengthSource = chunkLength;
+          batchEnd += chunkLength;
+          count++;
+        }
+
+        CompressBatch( view, offsets, Header.BlocksCount - count, count );
+        UnmapViewOfFile( view );
+      }
+      else {
+        batchEnd = batchStart + min( bodyLength - batchStart, batchLength - batchLength % Header.BlockSize );
+        ulong viewStart = batchStart - batchStart % info.dwAllocationGranularity;
+        byte* view = (byte*)MapViewOfFile( mapping, FILE_MAP_READ, 0, viewStart, batchEnd - viewStart );
+        ZIPASSERT( view != Null, "Can not map the file to compress." );
+        for( ulong position = batchStart; position < batchEnd; position += Header.BlockSize ) {
+          offsets[count++] = position - viewStart;
+          CreateBlock( Header.BlocksCount )->Header.LengthSource = min( Header.BlockSize, batchEnd - position );
+        }
+
+        CompressBatch( view, offsets, Header.BlocksCount - count, count );
+        UnmapViewOfFile( view );
+      }
+
+      Header.Length += batchEnd - batchStart;
+      batchStart = batchEnd;
+    }
+
+    if( tailLength > 0 ) {
+      ulong viewStart = bodyLength - bodyLength % info.dwAllocationGranularity;
+      byte* view = (byte*)MapViewOfFile( mapping, FILE_MAP_READ, 0, viewStart, length - viewStart );
+      ZIPASSERT( view != Null, "Can not map the file to compress." );
+      Position = Header.Length;
+      Write( view + (bodyLength - viewStart), tailLength );
+      UnmapViewOfFile( view );
+    }
+  }
+  catch( std::exception& ) {
+    delete[] offsets;
+    CloseHandle( mapping );
+    throw;
+  }
+
+  delete[] offsets;
+  CloseHandle( mapping );
+  Position = Header.Length;
+  return length;
+}
+
 void ZippedStreamWriter::Flush() {
   CommitData();
   CommitHeader();
 }
 
+void ZippedStreamWriter::Sync() {
+  // A partial fixed size block stays open, so its data
+  // is synced when the block is full. A chunk is ended.
+  ulong length = Header.Length;
+  uint blocksCount = Header.BlocksCount;
+  if( blocksCount > FirstBlock && !IsChunked() ) {
+    auto block = Blocks[blocksCount - 1];
+    if( !block->Cached() && block->Header.LengthSource < Header.BlockSize ) {
+      length -= block->Header.LengthSource;
+      blocksCount--;
+    }
+  }
+
+  for( uint i = FirstBlock; i < blocksCount; i++ )
+    FlushBlock( i );
+
+  // The blocks are durable before the header refers to them
+  FlushBaseStream();
+  WriteHeader( length, blocksCount );
+  FlushBaseStream();
+}
+
 ZippedStreamWriter::~ZippedStreamWriter() {
   Flush();
 }
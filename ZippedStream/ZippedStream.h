@@ -5,13 +5,77 @@ extern ZSTREAMAPI ulong ZIPPED_THREADS_COUNT;
 extern ZSTREAMAPI ulong BLOCK_SIZE_DEFAULT;
 extern ZSTREAMAPI ulong CACHE_READER_SIZE_DEFAULT;
 extern ZSTREAMAPI ulong CACHE_READER_STACK_COUNT_MAX;
+extern ZSTREAMAPI ulong PARALLEL_MEMORY_LIMIT;
+extern ZSTREAMAPI ulong PARALLEL_THREADS_COUNT;
 }
 
 #include "ZippedStreamException.h"
+#include "ZippedHash.h"
+#include "ZippedKernels.h"
+#include "ZippedChecksum.h"
+#include "ZippedParallel.h"
+#include "ZippedAsyncIO.h"
+#include "ZippedMemory.h"
+#include "ZippedIndex.h"
+#include "ZippedChunker.h"
 #include "ZippedStreamBlock.h"
 
 
 
+// The high bit of the stored BlockSize marks the
+// stream header which is followed by an extension.
+const ulong ZippedHeaderExtended      = 0x80000000;
+const ulong ZippedExtensionSignature  = 0x5853505A; // ZPSX
+const ulong ZippedTrailerSignature    = 0x5254535A; // ZSTR
+const ulong ZippedDictionarySizeMax   = 1024 * 32;  // deflate window
+const uint  ZippedLiveBlocksMin       = 64;         // Block objects kept by the reader before the release
+const ulong ZippedDiscoveryWindowMin  = 1024 * 64;   // Sequential read of the block headers,
+const ulong ZippedDiscoveryWindowMax  = 1024 * 1024; // doubled by every refill
+
+enum {
+  ZIPPED_STREAM_DICTIONARY    = 1 << 0,
+  ZIPPED_STREAM_DEDUPLICATION = 1 << 1,
+  ZIPPED_STREAM_CHUNKED       = 1 << 2, // Blocks have variable sizes up to BlockSize
+  ZIPPED_STREAM_FILL          = 1 << 3, // Single byte blocks are stored without data
+  ZIPPED_STREAM_FILTER        = 1 << 4, // Blocks are pre-filtered before deflate
+  ZIPPED_STREAM_CHECKSUM      = 1 << 5, // Blocks store CRC32C of their data
+  ZIPPED_STREAM_ALIGNED       = 1 << 6, // Blocks start at multiples of BlockAlignment
+  ZIPPED_STREAM_RECOVERY      = 1 << 7, // Blocks are framed for the recovery scan
+  ZIPPED_STREAM_TRAILER       = 1 << 8  // Written in order, the block table is in the trailer
+};
+
+struct ZippedStreamExtension {
+  ulong Signature;
+  ulong Size;               // Size of this structure in the file
+  ulong Flags;
+  ulong DictionaryLength;   // Dictionary bytes follow the structure
+  ulong BlockExtensionSize; // Size of ZippedBlockExtension in the file
+  ulong BlockAlignment;     // Relative to the stream start, zero padded
+  ulong HeaderChecksum;     // CRC32C of the header and the fields above
+};
+
+// End of a stream written to a non-seekable sink. The header of
+// such stream has no blocks. The chain ends with an empty block
+// header, then the index has the offsets and the positions of the
+// blocks and of the end, and the compressed lengths of the blocks.
+struct ZippedStreamTrailer {
+  ulong Signature;
+  ulong Length;
+  uint BlocksCount;
+  ulong IndexPosition; // Relative to the stream start
+};
+
+// Range of the batched reads. Readed is set by the
+// reader, it is less than Length at the stream end.
+struct ZippedReadRange {
+  ulong Position;
+  ulong Length;
+  byte* Buffer;
+  ulong Readed;
+};
+
+
+
 class ZSTREAMAPI ZippedStreamBase {
 protected:
   struct {
@@ -20,21 +84,50 @@ protected:
     uint BlocksCount;
   }
   Header;
+  ZippedStreamExtension Extension;
+  byte* Dictionary;
   long Position;
   ZippedBlockBase** Blocks;
+  ulong* BlockOffsets; // Uncompressed start position of every block
   FILE* BaseStream;
+  ZippedMemory* Memory; // Used instead of the BaseStream when not Null
   long BasePosition;
+  Common::ThreadLocker BaseStreamMutex; // Serializes the base stream access of the workers
+
+  void Init();
+  void InitBlock( ZippedBlockBase* block );
+  void ReadHeader();
+  bool HasHeaderChecksum();
+  ulong ComputeHeaderChecksum( const void* header, const ZippedStreamExtension& extension );
+  uint FindBlock( const ulong& position );
+  ulong AlignBlockOffset( const ulong& offset );
+  uint GetParallelThreadsCount();
+  virtual bool CompressBlock( const uint& blockID, const bool& clearSource );
+  virtual bool DecompressBlock( const uint& blockID, const bool& clearCompressed );
+  static void CompressTask( void* context, const uint& blockID );
+  static void DecompressTask( void* context, const uint& blockID );
 
 public:
   ZippedStreamBase( FILE* baseStream, long position = 0 );
+  ZippedStreamBase( ZippedMemory* memory );
   virtual long Tell();
   virtual long Seek( const long& offset, const uint& origin = SEEK_SET );
   virtual bool Compress( const bool& clearSource = true );
   virtual bool Decompress( const bool& clearCompressed = true );
   virtual void SetBlockSize( const ulong& length );
   virtual ulong GetBlockSize();
+  virtual ZippedMemory* GetMemory();
+  virtual void SetDictionary( byte* buffer, const ulong& length );
+  virtual void BuildDictionary( byte* sample, const ulong& length );
+  virtual bool IsExtended();
+  virtual bool IsChunked();
+  virtual ulong GetHeaderSize();
+  virtual ulong GetBlockExtensionSize();
   virtual void Close( const bool& closeBaseStream = true );
   virtual ulong GetStreamSize();
+  virtual ulong GetLength();
+  virtual uint GetBlocksCount();
+  virtual ulong GetFlags();
   virtual void CommitHeader() = 0;
   virtual void CommitData() = 0;
   virtual ulong Read( byte* buffer, const ulong& length ) = 0;
@@ -47,31 +140,143 @@ public:
 
 class ZSTREAMAPI ZippedStreamReader : public ZippedStreamBase {
 protected:
-  ZippedBlockBase* GetBlockToRead();
+  ZippedAsyncFile* AsyncFile; // Private handle for the block reads of the I/O workers
+  bool Verification;
+
+  // Packed block table. The block objects exist only for the live
+  // blocks, the others are Null in the Blocks and created on demand.
+  ulong* BlockPositions;    // Block header position in the base stream, the last one is the stream end
+  ulong* BlockLengths;      // Compressed data length of every block
+  Common::Array<uint> LiveBlocks;
+  uint LiveBlocksLimit;     // Count of the live blocks which starts the release
+
+  // The block headers are parsed only as far as the stream is used.
+  // The not discovered BlockOffsets are equal to the stream length.
+  uint DiscoveredCount;
+  ulong DiscoveryPosition;  // Header size and blocks of the discovered part
+  ulong DiscoveryOffset;    // Uncompressed start of the next block
+  byte* DiscoveryWindow;    // Base stream data around the next headers
+  ulong DiscoveryWindowPosition;
+  ulong DiscoveryWindowLength;
+  ulong DiscoveryWindowSize;
+  char* IndexFileName;      // Sidecar index written when the discovery ends
+
+  // Current block of the sequential reads, pinned while it is in use.
+  // The reads inside it are copied without the block lookup.
+  ZippedView ReadView;
+  ulong ReadPosition; // Stream position of the ReadView data
+  const byte* ReadPointer;
+  const byte* ReadEnd;
+
+  void Init();
+  void DiscoverNext();
+  void DiscoverBlock( const uint& blockID );
+  void DiscoverBlocks( const ulong& position );
+  void ReadHeaderChain( void* buffer, const ulong& position, const ulong& length );
+  bool GetIndexHeader( ZippedIndexHeader& header );
+  bool ReadTrailer( ZippedStreamTrailer& trailer );
+  ZippedBlockReader* CreateBlock( const uint& blockID );
+  ZippedBlockReader* GetBlock( const uint& blockID );
+  void ReleaseBlocks();
+  bool SetReadBlock();
+  ulong ReadBlocks( byte* buffer, const ulong& length );
+  void ReadAhead( const uint& blockID );
+  virtual bool DecompressBlock( const uint& blockID, const bool& clearCompressed );
+  static void VerifyTask( void* context, const uint& blockID );
+  static void ExtractTask( void* context, const uint& index );
+  static void ReadVTask( void* context, const uint& index );
 
 public:
   ZippedStreamReader( FILE* baseStream, long position = 0 );
+  ZippedStreamReader( ZippedMemory* memory );
+  virtual void SetDictionary( byte* buffer, const ulong& length );
+  virtual void SetVerification( const bool& enabled );
+  virtual bool Verify( const bool& decompress = true );
+  virtual bool Decompress( const bool& clearCompressed = true );
+  virtual ulong ExtractTo( HANDLE file, const ULONGLONG& fileOffset = 0, const ulong& position = 0, const ulong& length = Invalid );
+  virtual ulong ReadV( ZippedReadRange* ranges, const uint& count );
+  virtual bool SetDirectIO( const bool& enabled );
+  virtual void GetBlockInfo( const uint& blockID, ZippedBlockInfo& info );
+  virtual bool SetIndexFile( const char* fileName );
+  virtual bool SaveIndex( const char* fileName );
+  virtual uint Refresh();
+  virtual uint Recover();
+  virtual ulong GetStreamSize();
+  virtual uint GetLiveBlocksCount();
+  virtual bool Borrow( const ulong& position, const ulong& length, ZippedView& view );
+  virtual void Release( ZippedView& view );
   virtual void CommitHeader();
   virtual void CommitData();
+  virtual long Seek( const long& offset, const uint& origin = SEEK_SET );
   virtual ulong Read( byte* buffer, const ulong& length );
   virtual ulong Write( byte* buffer, const ulong& length );
   virtual bool EndOfFile();
+  virtual ~ZippedStreamReader();
 };
 
 
 
+struct ZippedBatchContext;
+
 class ZSTREAMAPI ZippedStreamWriter : public ZippedStreamBase {
   ZippedBlockBase* GetBlockToWrite();
   ulong LengthCompressed;
-  void FlushBlock( ZippedBlockBase* block );
+  ulong StreamSize;     // End of the flushed blocks, zero before the first one
+  uint FirstBlock;      // Blocks before it belong to the appended stream
+  ulong AppendedLength; // Length of the appended stream
+  ulong OutputPosition; // End of the written data, the streamed writes go only forward
+  bool Finished;        // The trailer of the streamed writer is written
+  ZippedHashTable Fingerprints;
+  ZippedChunker Chunker;
+  ulong Filter;
+  int Level;
+  void Init();
+  void WriteHeader( const ulong& length, const uint& blocksCount );
+  void WriteTrailer();
+  void WriteOut( const void* buffer, const ulong& position, const ulong& length );
+  void FlushBaseStream();
+  ZippedBlockWriter* CreateBlock( const uint& blockID );
+  void FlushBlock( const uint& blockID );
+  bool DeduplicateBlock( const uint& blockID );
+  bool DeduplicateBlock( const uint& blockID, const ZippedHash& hash, const byte* source, const ZippedBatchContext* batch = Null );
+  bool MatchBlock( const uint& referenceID, const byte* source, const ulong& length, const ZippedBatchContext* batch );
+  void CompressBatch( const byte* view, const ulong* offsets, const uint& firstBlock, const uint& count );
+  static void PrepareTask( void* context, const uint& index );
+  static void CompressBatchTask( void* context, const uint& index );
+protected:
+  virtual bool CompressBlock( const uint& blockID, const bool& clearSource );
+  virtual bool DecompressBlock( const uint& blockID, const bool& clearCompressed );
 public:
   ZippedStreamWriter( FILE* baseStream, long position = 0 );
+  ZippedStreamWriter( ZippedMemory* memory );
   virtual long Seek( const long& offset, const uint& origin = SEEK_SET );
+  virtual void SetDictionary( byte* buffer, const ulong& length );
+  virtual void SetDeduplication( const bool& enabled );
+  virtual void SetFillDetection( const bool& enabled );
+  virtual void SetChunking( const ulong& minSize, const ulong& averageSize, const ulong& maxSize );
+  virtual void SetFilter( const ulong& filter, const uint& elementSize );
+  virtual void SetChecksums( const bool& enabled );
+  virtual void SetLevel( const int& level );
+  virtual void SetBlockAlignment( const ulong& alignment );
+  virtual void SetRecovery( const bool& enabled );
+  virtual void SetStreaming( const bool& enabled );
+  virtual bool IsStreaming();
+  virtual void Append();
+  virtual ulong GetStreamSize();
+  virtual ulong CompressFile( const char* fileName );
+  virtual ulong CompressFile( HANDLE file );
   virtual void CommitHeader();
   virtual void CommitData();
   virtual ulong Read( byte* buffer, const ulong& length );
   virtual ulong Write( byte* buffer, const ulong& length );
   virtual bool EndOfFile();
   virtual void Flush();
+  // Writes the completed blocks and the header which covers them.
+  // The streamed writers only flush the blocks, their header is
+  // not rewritten and the length is known from the trailer.
+  virtual void Sync();
   virtual ~ZippedStreamWriter();
 };
+
+#include "ZippedBasicReader.h"
+#include "ZippedSequentialReader.h"
@@ -7,13 +7,16 @@ using std::cin;
 
 
 #pragma region base
-ZippedBlockBase::ZippedBlockBase( FILE* baseStream, const ulong& position ) : Buffer( BLOCK_SIZE_DEFAULT ) {
+ZippedBlockBase::ZippedBlockBase( FILE* baseStream, const ulong& position, const ulong& extensionSize, ZippedMemory* memory ) : Buffer( BLOCK_SIZE_DEFAULT ) {
   BaseStream = baseStream;
+  Memory = memory;
   BasePosition = position;
   Position = 0;
   Header.BlockSize = BLOCK_SIZE_DEFAULT;
   Header.LengthSource = 0;
   Header.LengthCompressed = 0;
+  HeaderExtensionSize = extensionSize;
+  memset( &HeaderExtension, 0, sizeof( HeaderExtension ) );
 }
 
 long ZippedBlockBase::Tell() {
@@ -68,6 +71,27 @@ bool ZippedBlockBase::IsDecompressed() {
   return Buffer.IsDecompressed();
 }
 
+bool ZippedBlockBase::IsReference() {
+  return (HeaderExtension.Flags & ZIPPED_BLOCK_REFERENCE) != 0;
+}
+
+bool ZippedBlockBase::IsFill() {
+  return (HeaderExtension.Flags & ZIPPED_BLOCK_FILL) != 0;
+}
+
+bool ZippedBlockBase::HasPayload() {
+  return !IsReference() && !IsFill();
+}
+
+bool ZippedBlockBase::HasChecksum() {
+  return (HeaderExtension.Flags & ZIPPED_BLOCK_CHECKSUM) != 0;
+}
+
+ulong ZippedBlockBase::GetHeaderChecksum() {
+  ulong checksum = ZippedChecksum::Compute( (byte*)&Header, sizeof( Header ) );
+  return ZippedChecksum::Compute( (byte*)&HeaderExtension, offsetof( ZippedBlockExtension, ChecksumHeader ), checksum );
+}
+
 ZippedBlockBase::~ZippedBlockBase() {
   // pass
 }
@@ -76,12 +100,231 @@ ZippedBlockBase::~ZippedBlockBase() {
 
 
 #pragma region reader
-ZippedBlockReader::ZippedBlockReader( FILE* baseStream, const ulong& position ) : ZippedBlockBase( baseStream, position ) {
+ZippedBlockReader::ZippedBlockReader( FILE* baseStream, const ulong& position, const ulong& extensionSize, ZippedMemory* memory ) : ZippedBlockBase( baseStream, position, extensionSize, memory ) {
   IsCached = false;
+  IsHeld = false;
+  Verification = false;
+  PinCount = 0;
+  ReferrersCount = 0;
+  Reference = Null;
+  AsyncFile = Null;
   CommitHeader();
 }
 
+void ZippedBlockReader::SetReference( ZippedBlockReader* block ) {
+  ZIPASSERT( block->Reference == Null, "Zipped block can not refer to another reference block." );
+  ZIPASSERT( block->Header.LengthSource == Header.LengthSource, "Zipped block refers to a block of another size." );
+  Reference = block;
+  Reference->ReferrersCount++;
+}
+
+void ZippedBlockReader::SetVerification( const bool& enabled ) {
+  // Without checksums only a failed inflate is reported
+  Verification = enabled;
+  Buffer.SetVerification( enabled, HasChecksum(), HeaderExtension.ChecksumSource );
+}
+
+void ZippedBlockReader::SetAsyncFile( ZippedAsyncFile* file ) {
+  AsyncFile = file;
+}
+
+void ZippedBlockReader::Load() {
+  if( !AsyncFile ) {
+    CommitData();
+    Decompress();
+    return;
+  }
+
+  // The I/O worker reads the data and passes it to the decompression
+  Buffer.BeginLoad();
+  ulong size = Header.LengthCompressed;
+  ULONGLONG offset = (ULONGLONG)BasePosition + sizeof( Header ) + HeaderExtensionSize;
+  ZippedAsyncIO::GetInstance().Read( AsyncFile, offset, new byte[size], size, &LoadTask, this );
+}
+
+void ZippedBlockReader::LoadTask( void* context, byte* data, const ulong& length ) {
+  ((ZippedBlockReader*)context)->CompleteLoad( data, length );
+}
+
+void ZippedBlockReader::CompleteLoad( byte* data, const ulong& length ) {
+  // Runs on the I/O worker, the errors are reported by the Corrupted flag
+  try {
+    if( Verification && !VerifyCompressed( data, length ) ) {
+      delete[] data;
+      Buffer.Corrupted = true;
+    }
+    else {
+      Buffer.Corrupted = false;
+      // Inflated on this worker, so the load does not
+      // wait for a thread of the decompression pool
+      Buffer.Compressed.SetBuffer( data, Header.LengthCompressed );
+      Buffer.Decompress( false );
+    }
+  }
+  catch( const std::exception& ) {
+    Buffer.Corrupted = true;
+  }
+
+  Buffer.EndLoad();
+}
+
+bool ZippedBlockReader::VerifyCompressed( const byte* data, const ulong& length ) {
+  if( length != Header.LengthCompressed )
+    return false;
+
+  if( !HasChecksum() )
+    return true;
+
+  return ZippedChecksum::Compute( data, length ) == HeaderExtension.ChecksumCompressed;
+}
+
+bool ZippedBlockReader::VerifyFrame( const uint& sequence ) {
+  // Blocks of the older writers have no framing
+  if( HeaderExtensionSize < sizeof( HeaderExtension ) )
+    return false;
+
+  return
+    HeaderExtension.Signature == ZippedBlockSignature &&
+    HeaderExtension.Sequence == sequence &&
+    HeaderExtension.ChecksumHeader == GetHeaderChecksum();
+}
+
+ulong ZippedBlockReader::ReadCompressed( byte* buffer, Common::ThreadLocker& baseStreamMutex ) {
+  baseStreamMutex.Enter();
+  ulong readed = ZippedMemory::ReadAt( BaseStream, Memory, buffer, BasePosition + sizeof( Header ) + HeaderExtensionSize, Header.LengthCompressed );
+  baseStreamMutex.Leave();
+  return readed;
+}
+
+bool ZippedBlockReader::DecompressTo( ZippedBuffer& buffer, Common::ThreadLocker& baseStreamMutex, const bool& verify ) {
+  ulong size = Header.LengthCompressed;
+  byte* data = GetMemoryData();
+  bool view = data != Null;
+  ulong readed = size;
+  if( !view ) {
+    data = new byte[size];
+    readed = ReadCompressed( data, baseStreamMutex );
+  }
+
+  if( verify && !VerifyCompressed( data, readed ) ) {
+    if( !view )
+      delete[] data;
+    return false;
+  }
+
+  // The errors are returned as the result, so the worker does not throw
+  buffer.LengthMax = Header.LengthSource;
+  buffer.SetDictionary( Buffer.Dictionary, Buffer.DictionaryLength );
+  buffer.SetFilter( HeaderExtension.Filter );
+  buffer.SetVerification( true, verify && HasChecksum(), HeaderExtension.ChecksumSource );
+  if( view )
+    buffer.Compressed.SetView( data, size );
+  else
+    buffer.Compressed.SetBuffer( data, size );
+
+  buffer.Decompress( false );
+  return !buffer.Corrupted && buffer.Source.GetLength() == Header.LengthSource;
+}
+
+bool ZippedBlockReader::Materialize( Common::ThreadLocker& baseStreamMutex ) {
+  // References are loaded by the tasks of their blocks
+  if( !HasPayload() || IsCached )
+    return true;
+
+  bool success = DecompressTo( Buffer, baseStreamMutex, Verification );
+  Buffer.SetVerification( Verification, HasChecksum(), HeaderExtension.ChecksumSource );
+  if( !success ) {
+    Buffer.Clear();
+    return false;
+  }
+
+  // The block stays in memory outside of the cache until CacheOut
+  IsCached = true;
+  return true;
+}
+
+static const byte* GetFillPage( const byte& value ) {
+  // One page of every fill value is shared by all blocks
+  static byte* pages[256] = { Null };
+  static Common::ThreadLocker pagesMutex;
+  pagesMutex.Enter();
+  if( !pages[value] ) {
+    pages[value] = new byte[ZippedFillPageSize];
+    memset( pages[value], value, ZippedFillPageSize );
+  }
+
+  byte* page = pages[value];
+  pagesMutex.Leave();
+  return page;
+}
+
+bool ZippedBlockReader::Borrow( const ulong& position, const ulong& length, ZippedView& view ) {
+  if( Reference )
+    return Reference->Borrow( position, length, view );
+
+  // Fill blocks are never cached, the view
+  // is a part of the shared page of the value
+  ulong memLeft = position < Header.LengthSource ? Header.LengthSource - position : 0;
+  view.Length = min( length, memLeft );
+  if( IsFill() )
+    view.Length = min( view.Length, ZippedFillPageSize );
+
+  if( view.Length == 0 ) {
+    view.Data  = Null;
+    view.Block = Null;
+    return false;
+  }
+
+  if( IsFill() )
+    view.Data = GetFillPage( (byte)HeaderExtension.Reference );
+  else {
+    ZippedBlockReaderCache::GetInstance()->CacheIn( this );
+    Buffer.WaitForDecompress();
+    ZIPASSERT( !Buffer.Corrupted, "Zipped block is corrupted." );
+    view.Data = Buffer.Source.GetBuffer() + position;
+  }
+
+  Pin();
+  view.Block = this;
+  return true;
+}
+
+void ZippedBlockReader::Pin() {
+  PinCount++;
+}
+
+void ZippedBlockReader::Unpin() {
+  ZIPASSERT( PinCount > 0, "Zipped block is not pinned." );
+  PinCount--;
+  if( PinCount == 0 )
+    Drop();
+}
+
+void ZippedBlockReader::Drop() {
+  // The data held outside of the cache is freed by the last user
+  if( IsHeld ) {
+    Buffer.WaitForDecompress();
+    Buffer.Clear();
+    IsHeld = false;
+  }
+}
+
+bool ZippedBlockReader::IsPinned() {
+  return PinCount > 0;
+}
+
+bool ZippedBlockReader::IsLive() {
+  // The other blocks can be deleted by the stream
+  return IsCached || IsHeld || PinCount > 0 || ReferrersCount > 0 || Buffer.DecompressIsActive();
+}
+
 bool ZippedBlockReader::Decompress( const bool& clearCompressed ) {
+  if( Reference )
+    return Reference->Decompress( clearCompressed );
+
+  if( IsFill() )
+    return true;
+
   if( !IsDecompressed() )
     Buffer.Decompress( true );
 
@@ -89,21 +332,48 @@ bool ZippedBlockReader::Decompress( const bool& clearCompressed ) {
 }
 
 void ZippedBlockReader::CommitHeader() {
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition, SEEK_SET );
-  fread( &Header, 1, sizeof( Header ), BaseStream );
+  ZippedMemory::ReadAt( BaseStream, Memory, &Header, BasePosition, sizeof( Header ) );
+  if( HeaderExtensionSize > 0 )
+    ZippedMemory::ReadAt( BaseStream, Memory, &HeaderExtension, BasePosition + sizeof( Header ), min( HeaderExtensionSize, sizeof( HeaderExtension ) ) );
+
   Buffer.LengthMax = Header.LengthSource;
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  Buffer.SetFilter( HeaderExtension.Filter );
+}
+
+byte* ZippedBlockReader::GetMemoryData() {
+  if( !Memory )
+    return Null;
+
+  // A truncated block is read by the usual way and fails the checks
+  ulong position = BasePosition + sizeof( Header ) + HeaderExtensionSize;
+  if( position + Header.LengthCompressed > Memory->GetLength() )
+    return Null;
+
+  return Memory->GetBuffer() + position;
 }
 
 void ZippedBlockReader::CommitData() {
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition + sizeof( Header ), SEEK_SET );
   ulong size = Header.LengthCompressed;
-  byte* data = new byte[size];
-  fread( data, 1, size, BaseStream );
+  byte* data = GetMemoryData();
+  if( data ) {
+    // Inflated straight from the memory
+    if( Verification && !VerifyCompressed( data, size ) )
+      throw std::exception( "Zipped block is corrupted." );
+
+    Buffer.Compressed.SetView( data, size );
+    return;
+  }
+
+  data = new byte[size];
+  ulong readed = ZippedMemory::ReadAt( BaseStream, Memory, data, BasePosition + sizeof( Header ) + HeaderExtensionSize, size );
+
+  // Checked here, so the broken data never goes to the worker threads
+  if( Verification && !VerifyCompressed( data, readed ) ) {
+    delete[] data;
+    throw std::exception( "Zipped block is corrupted." );
+  }
+
   Buffer.Compressed.SetBuffer( data, size );
-  fseek( BaseStream, returnPosition, SEEK_SET );
 }
 
 void ZippedBlockReader::SetBlockSize( const ulong& length ) {
@@ -111,10 +381,25 @@ void ZippedBlockReader::SetBlockSize( const ulong& length ) {
 }
 
 ulong ZippedBlockReader::GetFileSize() {
-  return sizeof( Header ) + Header.LengthCompressed;
+  return sizeof( Header ) + HeaderExtensionSize + Header.LengthCompressed;
 }
 
 ulong ZippedBlockReader::Read( byte* buffer, const ulong& length ) {
+  if( Reference ) {
+    Reference->Seek( Position );
+    ulong readed = Reference->Read( buffer, length );
+    Position += readed;
+    return readed;
+  }
+
+  // Fill blocks have no data and never go to the cache
+  if( IsFill() ) {
+    ulong toFill = min( length, Header.LengthSource - Position );
+    memset( buffer, (byte)HeaderExtension.Reference, toFill );
+    Position += toFill;
+    return toFill;
+  }
+
   CacheIn();
 
   ulong memLeft = Header.LengthSource - Position;
@@ -123,8 +408,12 @@ ulong ZippedBlockReader::Read( byte* buffer, const ulong& length ) {
     return 0;
 
   Buffer.WaitForDecompress();
+  ZIPASSERT( !Buffer.Corrupted, "Zipped block is corrupted." );
   memcpy( buffer, Buffer.Source.GetBuffer() + Position, toRead );
   Position += toRead;
+  if( !IsPinned() )
+    Drop();
+
   return toRead;
 }
 
@@ -137,10 +426,17 @@ bool ZippedBlockReader::EndOfBlock() {
 }
 
 bool ZippedBlockReader::CacheIn( const ulong& position ) {
+  if( Reference )
+    return Reference->CacheIn( position );
+
+  if( IsFill() )
+    return false;
+
   return ZippedBlockReaderCache::GetInstance()->CacheIn( this );
 }
 
 void ZippedBlockReader::CacheOut() {
+  Drop();
   if( IsCached ) {
     ZippedBlockReaderCache::GetInstance()->CacheInvalidate( this );
     Buffer.Clear();
@@ -149,10 +445,19 @@ void ZippedBlockReader::CacheOut() {
 }
 
 bool ZippedBlockReader::Cached() {
+  if( Reference )
+    return Reference->Cached();
+
+  if( IsFill() )
+    return true;
+
   return IsCached;
 }
 
 ZippedBlockReader::~ZippedBlockReader() {
+  if( Reference )
+    Reference->ReferrersCount--;
+
   CacheOut();
 }
 #pragma endregion
@@ -160,29 +465,110 @@ ZippedBlockReader::~ZippedBlockReader() {
 
 
 #pragma region writer
-ZippedBlockWriter::ZippedBlockWriter( FILE* baseStream, const ulong& position ) : ZippedBlockBase( baseStream, position ) {
-  
+ZippedBlockWriter::ZippedBlockWriter( FILE* baseStream, const ulong& position, const ulong& extensionSize, ZippedMemory* memory ) : ZippedBlockBase( baseStream, position, extensionSize, memory ) {
+  IsCached = false;
+  FillDetection = false;
+  Checksums = false;
+  FillValue = 0;
+  HeaderExtension.Signature = ZippedBlockSignature;
+}
+
+void ZippedBlockWriter::SetFillDetection( const bool& enabled ) {
+  ZIPASSERT( Header.LengthSource == 0, "Can not change a zipped block fill detection after start of writing." );
+  FillDetection = enabled;
+}
+
+void ZippedBlockWriter::SetFilter( const ulong& filter ) {
+  ZIPASSERT( HeaderExtensionSize > 0 || filter == 0, "Can not write a zipped block filter into the simple stream." );
+  HeaderExtension.Filter = filter;
+  Buffer.SetFilter( filter );
+}
+
+void ZippedBlockWriter::SetLevel( const int& level ) {
+  Buffer.SetLevel( level );
+}
+
+void ZippedBlockWriter::SetChecksums( const bool& enabled ) {
+  ZIPASSERT( HeaderExtensionSize > 0 || !enabled, "Can not write a zipped block checksum into the simple stream." );
+  Checksums = enabled;
+}
+
+void ZippedBlockWriter::SetSequence( const uint& sequence ) {
+  HeaderExtension.Sequence = sequence;
+}
+
+bool ZippedBlockWriter::Compress( const bool& clearSource ) {
+  if( IsCompressed() || Buffer.Source.GetLength() == 0 )
+    return ZippedBlockBase::Compress( clearSource );
+
+  CompressFrom( Buffer.Source.GetBuffer(), Buffer.Source.GetLength() );
+  if( clearSource )
+    Buffer.Source.Clear();
+
+  return Header.LengthCompressed > 0;
+}
+
+void ZippedBlockWriter::CompressFrom( const byte* buffer, const ulong& length ) {
+  if( Checksums )
+    HeaderExtension.ChecksumSource = ZippedChecksum::Compute( buffer, length );
+
+  Buffer.CompressFrom( buffer, length );
+  Header.LengthCompressed = Buffer.Compressed.GetLength();
+
+  if( Checksums ) {
+    HeaderExtension.ChecksumCompressed = ZippedChecksum::Compute( Buffer.Compressed.GetBuffer(), Buffer.Compressed.GetLength() );
+    HeaderExtension.Flags |= ZIPPED_BLOCK_CHECKSUM;
+  }
+}
+
+bool ZippedBlockWriter::CommitFill() {
+  // Bytes of the filled block were only counted by Write
+  if( !FillDetection || Header.LengthSource == 0 || Buffer.Source.GetLength() > 0 )
+    return false;
+
+  HeaderExtension.Flags |= ZIPPED_BLOCK_FILL;
+  HeaderExtension.Reference = FillValue;
+  Header.LengthCompressed = 0;
+  return true;
+}
+
+bool ZippedBlockWriter::CommitFill( const byte* buffer ) {
+  // The data is not owned by the block, its length is set by the stream
+  if( !FillDetection || Header.LengthSource == 0 || !ZippedKernels::IsFilled( buffer, Header.LengthSource, buffer[0] ) )
+    return false;
+
+  FillValue = buffer[0];
+  return CommitFill();
+}
+
+void ZippedBlockWriter::SetReference( const uint& blockID ) {
+  ZIPASSERT( HeaderExtensionSize > 0, "Can not write a zipped block reference into the simple stream." );
+  HeaderExtension.Flags |= ZIPPED_BLOCK_REFERENCE;
+  HeaderExtension.Reference = blockID;
+  Header.LengthCompressed = 0;
+  Buffer.Source.Clear();
 }
 
 void ZippedBlockWriter::CommitHeader() {
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition, SEEK_SET );
-  fwrite( &Header, 1, sizeof( Header ), BaseStream );
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  // The streams of the older writers keep their shorter extension
+  HeaderExtension.ChecksumHeader = GetHeaderChecksum();
+  ZippedMemory::WriteAt( BaseStream, Memory, &Header, BasePosition, sizeof( Header ) );
+  if( HeaderExtensionSize > 0 )
+    ZippedMemory::WriteAt( BaseStream, Memory, &HeaderExtension, BasePosition + sizeof( Header ), min( HeaderExtensionSize, sizeof( HeaderExtension ) ) );
 }
 
 void ZippedBlockWriter::CommitData() {
   if( Buffer.Compressed.GetLength() == 0 )
     return;
 
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition + sizeof( Header ), SEEK_SET );
-  fwrite( Buffer.Compressed.GetBuffer(), 1, Buffer.Compressed.GetLength(), BaseStream );
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  ZippedMemory::WriteAt( BaseStream, Memory, Buffer.Compressed.GetBuffer(), BasePosition + sizeof( Header ) + HeaderExtensionSize, Buffer.Compressed.GetLength() );
 }
 
 ulong ZippedBlockWriter::GetFileSize() {
-  return Header.LengthSource;
+  if( !IsCached )
+    return 0;
+
+  return sizeof( Header ) + HeaderExtensionSize + Header.LengthCompressed;
 }
 
 void ZippedBlockWriter::SetBlockSize( const ulong& length ) {
@@ -196,6 +582,20 @@ ulong ZippedBlockWriter::Read( byte* buffer, const ulong& length ) {
 }
 
 ulong ZippedBlockWriter::Write( byte* buffer, const ulong& length ) {
+  // While the data is a single byte fill the block does
+  // not allocate the buffer and only counts the written bytes
+  if( FillDetection && Buffer.Source.GetLength() == 0 ) {
+    ulong toWrite = min( length, Buffer.LengthMax - Header.LengthSource );
+    byte value = Header.LengthSource > 0 ? FillValue : buffer[0];
+    if( ZippedKernels::IsFilled( buffer, toWrite, value ) ) {
+      FillValue = value;
+      Header.LengthSource += toWrite;
+      return toWrite;
+    }
+
+    Buffer.Source.Fill( FillValue, Header.LengthSource );
+  }
+
   ulong writed = Buffer.Source.Write( buffer, length );
   Header.LengthSource += writed;
   return writed;
@@ -206,32 +606,42 @@ bool ZippedBlockWriter::EndOfBlock() {
 }
 
 bool ZippedBlockWriter::CacheIn( const ulong& position ) {
-  ZIPASSERT( Buffer.Compressed.GetLength() > 0, "Buffer must be compressed before caching." );
+  ZIPASSERT( Buffer.Compressed.GetLength() > 0 || !HasPayload(), "Buffer must be compressed before caching." );
   if( position != -1 )
     BasePosition = position;
 
   CommitHeader();
   CommitData();
   Buffer.Clear();
+  IsCached = true;
   return true;
 }
 
+ulong ZippedBlockWriter::CommitTo( byte* buffer ) {
+  // Same layout as CommitHeader and CommitData, used for the coalesced writes
+  ZIPASSERT( Buffer.Compressed.GetLength() > 0 || !HasPayload(), "Buffer must be compressed before caching." );
+  HeaderExtension.ChecksumHeader = GetHeaderChecksum();
+  memcpy( buffer, &Header, sizeof( Header ) );
+  if( HeaderExtensionSize > 0 )
+    memcpy( buffer + sizeof( Header ), &HeaderExtension, min( HeaderExtensionSize, sizeof( HeaderExtension ) ) );
+
+  memcpy( buffer + sizeof( Header ) + HeaderExtensionSize, Buffer.Compressed.GetBuffer(), Buffer.Compressed.GetLength() );
+  Buffer.Clear();
+  IsCached = true;
+  return GetFileSize();
+}
+
 void ZippedBlockWriter::CacheOut() {
   ulong bufferSize = Header.LengthCompressed;
   byte* buffer = new byte[bufferSize];
   Buffer.Compressed.SetBuffer( buffer, bufferSize );
 
-  long returnPosition = ftell( BaseStream );
-  fseek( BaseStream, BasePosition + sizeof( Header ), SEEK_SET );
-  fread( Buffer.Compressed.GetBuffer(), 1, Buffer.Compressed.GetLength(), BaseStream );
-  fseek( BaseStream, returnPosition, SEEK_SET );
+  ZippedMemory::ReadAt( BaseStream, Memory, Buffer.Compressed.GetBuffer(), BasePosition + sizeof( Header ) + HeaderExtensionSize, Buffer.Compressed.GetLength() );
+  IsCached = false;
 }
 
 bool ZippedBlockWriter::Cached() {
-  return
-    Header.LengthCompressed > 0 &&
-    Buffer.Source.GetLength() == 0 &&
-    Buffer.Compressed.GetLength() == 0;
+  return IsCached;
 }
 #pragma endregion
 
@@ -252,12 +662,27 @@ uint ZippedBlockReaderCache::GetBlocksCount() {
 }
 
 bool ZippedBlockReaderCache::CacheIn( ZippedBlockReader* block ) {
-  if( GetTopBlock() == block )
+  // Fill blocks have no data to hold
+  if( block->IsFill() || GetTopBlock() == block )
     return false;
 
   if( block->IsCached )
     return false;
 
+  // The pinned blocks can fill the whole stack. When no slot
+  // is freed, the block holds its data until it is unpinned
+  if( StackSize >= StackSizeMax - 1 )
+    CacheReduce();
+
+  if( StackSize >= StackSizeMax - 1 ) {
+    if( !block->IsHeld ) {
+      block->Load();
+      block->IsHeld = true;
+    }
+
+    return false;
+  }
+
   Push( block );
   
   static const uint SizePerThread = 1024 * 1024 * 2;
@@ -273,7 +698,7 @@ bool ZippedBlockReaderCache::CacheIn( ZippedBlockReader* block ) {
 }
 
 void ZippedBlockReaderCache::CacheOut( ZippedBlockReader* block ) {
-  if( block->IsCached )
+  if( block->IsCached && !block->IsPinned() )
     Pop( block );
 }
 
@@ -288,25 +713,37 @@ void ZippedBlockReaderCache::CacheInvalidate( ZippedBlockReader* block ) {
 }
 
 void ZippedBlockReaderCache::CacheOutLast() {
-  if( StackSize > 0 )
-    Pop( Stack[0] );
+  for( uint i = 0; i < StackSize; i++ ) {
+    if( Stack[i] != Null && !Stack[i]->IsPinned() ) {
+      Pop( Stack[i] );
+      break;
+    }
+  }
 }
 
 void ZippedBlockReaderCache::CacheReduce() {
+  // Pinned blocks are moved down and stay in the cache
   uint toRemove = StackSize / 2;
-  for( uint i = 0; i < toRemove && i < StackSize - 1; i++ ) {
-    if( Stack[i] != Null ) {
-      auto& block = Stack[i];
-      CacheSize -= block->Header.LengthSource;
-      block->Buffer.Clear();
-      block->IsCached = false;
+  uint keptCount = 0;
+  uint i = 0;
+  for( ; toRemove > 0 && i < StackSize - 1; i++ ) {
+    auto block = Stack[i];
+    if( block == Null )
+      continue;
+
+    if( block->IsPinned() ) {
+      Stack[keptCount++] = block;
+      continue;
     }
-    else
-      toRemove++;
+
+    CacheSize -= block->Header.LengthSource;
+    block->Buffer.Clear();
+    block->IsCached = false;
+    toRemove--;
   }
   
-  Move( 0, toRemove, StackSize - toRemove );
-  StackSize -= toRemove;
+  Move( keptCount, i, StackSize - i );
+  StackSize -= i - keptCount;
 }
 
 void ZippedBlockReaderCache::SetMemoryLimit( const ulong& size ) {
@@ -321,9 +758,13 @@ ZippedBlockReader* ZippedBlockReaderCache::GetTopBlock() {
 }
 
 void ZippedBlockReaderCache::Push( ZippedBlockReader* block ) {
+  // The held data moves to the cache
+  if( block->IsHeld )
+    block->IsHeld = false;
+  else
+    block->Load();
+
   block->IsCached = true;
-  block->CommitData();
-  block->Decompress();
   CacheSize += block->Header.LengthSource;
   Stack[StackSize++] = block;
 }
@@ -346,8 +787,8 @@ void ZippedBlockReaderCache::Pop( ZippedBlockReader* block ) {
 void ZippedBlockReaderCache::Move( const uint& toID, const uint& fromID, const uint& count ) {
   void* from  = &Stack[fromID];
   void* to    = &Stack[toID];
-  uint length = count * 4;
-  memcpy( to, from, length );
+  uint length = count * sizeof( ZippedBlockReader* );
+  memmove( to, from, length );
 }
 
 ZippedBlockReaderCache* ZippedBlockReaderCache::GetInstance() {
@@ -4,32 +4,86 @@
 
 
 
+enum {
+  ZIPPED_BLOCK_REFERENCE = 1 << 0, // Data is stored in the block with ID from Reference
+  ZIPPED_BLOCK_FILL      = 1 << 1, // Every byte of the block equals Reference
+  ZIPPED_BLOCK_CHECKSUM  = 1 << 2  // Checksums of the block data are valid
+};
+
+const ulong ZippedBlockSignature = 0x4B4C425A; // ZBLK
+const ulong ZippedFillPageSize   = 1024 * 64;  // Borrowed views of the fill blocks
+
+struct ZippedBlockHeader {
+  ulong LengthSource;
+  ulong LengthCompressed;
+  ulong BlockSize;
+};
+
+struct ZippedBlockExtension {
+  ulong Flags;
+  ulong Reference; // Block ID or the fill value
+  ulong Filter;    // Pre-filter of the block data, see ZIPPED_FILTER_*
+  ulong ChecksumCompressed;
+  ulong ChecksumSource;
+  ulong Signature;      // ZippedBlockSignature, the recovery scan checks it
+  ulong Sequence;       // Block ID
+  ulong ChecksumHeader; // Header and the extension fields before it
+};
+
+// Block description for the stream inspection
+struct ZippedBlockInfo {
+  ulong Position;     // Uncompressed start of the block
+  ulong FilePosition; // Block header position in the base stream
+  ulong FileSize;     // Header and data size in the base stream
+  ulong LengthSource;
+  ulong LengthCompressed;
+  ulong Flags;
+  ulong Reference;
+  ulong Filter;
+};
+
+class ZippedBlockReader;
+
+// Decompressed data of a block lent to the caller without a copy.
+// The block can not leave the cache until the view is released.
+struct ZippedView {
+  const byte* Data;
+  ulong Length;
+  ZippedBlockReader* Block; // Pinned block, Null for an empty view
+};
+
+
+
 class ZSTREAMAPI ZippedBlockBase {
   friend class ZippedStreamBase;
   friend class ZippedStreamReader;
   friend class ZippedStreamWriter;
   friend class ZippedBlockStack;
 protected:
-  struct {
-    ulong LengthSource;
-    ulong LengthCompressed;
-    ulong BlockSize;
-  }
-  Header;
+  ZippedBlockHeader Header;
 
+  // Stored after the Header in the extended streams
+  ZippedBlockExtension HeaderExtension;
+  ulong HeaderExtensionSize;
   ulong Position;
   ZippedBuffer Buffer;
   FILE* BaseStream;
+  ZippedMemory* Memory; // Used instead of the BaseStream when not Null
   ulong BasePosition;
 
 public:
-  ZippedBlockBase( FILE* baseStream, const ulong& position );
+  ZippedBlockBase( FILE* baseStream, const ulong& position, const ulong& extensionSize = 0, ZippedMemory* memory = Null );
   virtual long Tell();
   virtual long Seek( const long& offset, const uint& origin = SEEK_SET );
   virtual bool Compress( const bool& clearSource = true );
   virtual bool Decompress( const bool& clearCompressed = true );
   virtual bool IsCompressed();
   virtual bool IsDecompressed();
+  virtual bool IsReference();
+  virtual bool IsFill();
+  virtual bool HasPayload();
+  virtual bool HasChecksum();
+  virtual ulong GetHeaderChecksum();
   virtual void CommitHeader() = 0;
   virtual void CommitData() = 0;
   virtual void SetBlockSize( const ulong& length ) = 0;
@@ -49,9 +103,33 @@ class ZSTREAMAPI ZippedBlockReader : public ZippedBlockBase {
 private:
   friend class ZippedBlockReaderCache;
   bool IsCached;
+  bool IsHeld; // Loaded outside of the cache full of the pinned blocks
+  bool Verification;
+  uint PinCount; // Pinned blocks are skipped by the cache eviction
+  uint ReferrersCount;
+  ZippedBlockReader* Reference;
+  ZippedAsyncFile* AsyncFile;
+  byte* GetMemoryData();
+  void Drop();
+  static void LoadTask( void* context, byte* data, const ulong& length );
 
 public:
-  ZippedBlockReader( FILE* baseStream, const ulong& position );
+  ZippedBlockReader( FILE* baseStream, const ulong& position, const ulong& extensionSize = 0, ZippedMemory* memory = Null );
+  virtual void SetReference( ZippedBlockReader* block );
+  virtual void SetVerification( const bool& enabled );
+  virtual void SetAsyncFile( ZippedAsyncFile* file );
+  virtual void Load();
+  virtual void CompleteLoad( byte* data, const ulong& length );
+  virtual bool VerifyCompressed( const byte* data, const ulong& length );
+  virtual bool VerifyFrame( const uint& sequence );
+  virtual ulong ReadCompressed( byte* buffer, Common::ThreadLocker& baseStreamMutex );
+  virtual bool DecompressTo( ZippedBuffer& buffer, Common::ThreadLocker& baseStreamMutex, const bool& verify );
+  virtual bool Materialize( Common::ThreadLocker& baseStreamMutex );
+  virtual bool Borrow( const ulong& position, const ulong& length, ZippedView& view );
+  virtual void Pin();
+  virtual void Unpin();
+  virtual bool IsPinned();
+  virtual bool IsLive();
   virtual bool Decompress( const bool& clearCompressed = true );
   virtual void CommitHeader();
   virtual void CommitData();
@@ -69,8 +147,24 @@ public:
 
 
 class ZSTREAMAPI ZippedBlockWriter : public ZippedBlockBase {
+  bool IsCached;
+  bool FillDetection;
+  bool Checksums;
+  byte FillValue;
+
 public:
-  ZippedBlockWriter( FILE* baseStream, const ulong& position = 0 );
+  ZippedBlockWriter( FILE* baseStream, const ulong& position = 0, const ulong& extensionSize = 0, ZippedMemory* memory = Null );
+  virtual void SetReference( const uint& blockID );
+  virtual void SetFillDetection( const bool& enabled );
+  virtual void SetFilter( const ulong& filter );
+  virtual void SetLevel( const int& level );
+  virtual void SetChecksums( const bool& enabled );
+  virtual void SetSequence( const uint& sequence );
+  virtual bool Compress( const bool& clearSource = true );
+  virtual void CompressFrom( const byte* buffer, const ulong& length );
+  virtual bool CommitFill();
+  virtual bool CommitFill( const byte* buffer );
+  virtual ulong CommitTo( byte* buffer );
   virtual void CommitHeader();
   virtual void CommitData();
   virtual ulong GetFileSize();
@@ -1,125 +1,395 @@
 #include "ZippedAfx.h"
-#include <iostream>
-using std::string;
-using std::cout;
-using std::endl;
-using std::cin;
-
-const bool DebugWriteFiles = false;
-
-void TestCompress() {
-  cout << "Compressed test . . ." << endl;
-  char* fileName = "Textures.vdf";
-  FILE* fileIn = fopen( fileName, "rb" );
-  if( fileIn == Null ) {
-    throw std::exception( "Can not open Input file." );
-    return;
+#include <io.h>
+#include <fcntl.h>
+
+// zstream - command line tool for the zipped streams.
+// The reports go to stderr, so the cat output stays clean.
+
+struct ZippedToolOptions {
+  uint Threads;
+  ulong BlockSize;
+  int Level;
+  const char* Codec;
+  bool Checksums;
+  bool Recovery;
+  bool Index;
+  ulong Alignment;
+  ulong Offset;
+  ulong Length;
+  const char* Input;
+  const char* Output;
+};
+
+
+
+static void PrintUsage() {
+  fprintf( stderr,
+    "Usage: zstream <command> [options] <input> [output]\n"
+    "\n"
+    "Commands:\n"
+    "  pack   <input> <output>  Compress the file into a zipped stream, - for stdout\n"
+    "  unpack <input> <output>  Decompress the zipped stream into a file\n"
+    "  cat    <input>           Write the uncompressed range to stdout\n"
+    "  decode <input>           Write the whole stream to stdout, - reads stdin\n"
+    "  verify <input>           Check every block of the zipped stream\n"
+    "  stat   <input>           Show the stream index and the blocks\n"
+    "  recover <input>          Repair the stream of a crashed writer\n"
+    "\n"
+    "Options:\n"
+    "  -j <count>  Worker threads, all cores by default\n"
+    "  -b <size>   Block size for pack, accepts K and M suffixes\n"
+    "  -l <level>  Deflate level for pack, 0-9\n"
+    "  -c <codec>  Codec for pack, only deflate is supported\n"
+    "  -k          Store block checksums on pack\n"
+    "  -r          Frame the blocks on pack for the recovery\n"
+    "  -a <size>   Align block starts for pack, 4K for the direct reads\n"
+    "  -x          Keep the block index in the <input>.zsidx file\n"
+    "  -o <offset> Start of the range for cat\n"
+    "  -n <length> Length of the range for cat\n" );
+}
+
+static ulong ParseSize( const char* text ) {
+  char* end = Null;
+  ulong value = strtoul( text, &end, 10 );
+  ZIPASSERT( end != text, "Bad number in the command line." );
+  if( *end == 'K' || *end == 'k' )
+    value *= 1024;
+  else if( *end == 'M' || *end == 'm' )
+    value *= 1024 * 1024;
+
+  return value;
+}
+
+static bool ParseOptions( int argc, char** argv, ZippedToolOptions& options ) {
+  options.Threads   = 0;
+  options.BlockSize = BLOCK_SIZE_DEFAULT;
+  options.Level     = Z_DEFAULT_COMPRESSION;
+  options.Codec     = "deflate";
+  options.Checksums = false;
+  options.Recovery  = false;
+  options.Index     = false;
+  options.Alignment = 0;
+  options.Offset    = 0;
+  options.Length    = Invalid;
+  options.Input     = Null;
+  options.Output    = Null;
+
+  for( int i = 2; i < argc; i++ ) {
+    const char* argument = argv[i];
+    if( argument[0] != '-' || argument[1] == 0 ) {
+      if( !options.Input )
+        options.Input = argument;
+      else if( !options.Output )
+        options.Output = argument;
+      else
+        return false;
+      continue;
+    }
+
+    char key = argument[1];
+    if( key == 'k' ) {
+      options.Checksums = true;
+      continue;
+    }
+
+    if( key == 'r' ) {
+      options.Recovery = true;
+      continue;
+    }
+
+    if( key == 'x' ) {
+      options.Index = true;
+      continue;
+    }
+
+    // Every other option has a value
+    if( i + 1 >= argc )
+      return false;
+
+    const char* value = argv[++i];
+    switch( key ) {
+      case 'j': options.Threads   = ParseSize( value ); break;
+      case 'b': options.BlockSize = ParseSize( value ); break;
+      case 'l': options.Level     = ParseSize( value ); break;
+      case 'c': options.Codec     = value;              break;
+      case 'a': options.Alignment = ParseSize( value ); break;
+      case 'o': options.Offset    = ParseSize( value ); break;
+      case 'n': options.Length    = ParseSize( value ); break;
+      default: return false;
+    }
   }
 
-  ZippedStreamWriter* writer = new ZippedStreamWriter( fopen( "zipped.vdf", "wb+" ) );
+  return options.Input != Null;
+}
+
+static void PrintThroughput( const char* action, const ulong& length, const uint& time ) {
+  double seconds = max( time, 1u ) / 1000.0;
+  fprintf( stderr, "%s %lu bytes in %u ms, %.1f MB/s\n", action, length, time, length / seconds / (1024 * 1024) );
+}
+
+static ZippedStreamReader* OpenReader( ZippedToolOptions& options ) {
+  FILE* file = fopen( options.Input, "rb" );
+  ZIPASSERT( file != Null, "Can not open the input file." );
+  ZippedStreamReader* reader = new ZippedStreamReader( file );
+  if( options.Index ) {
+    char indexName[MAX_PATH];
+    _snprintf( indexName, sizeof( indexName ) - 1, "%s.zsidx", options.Input );
+    indexName[sizeof( indexName ) - 1] = 0;
+    reader->SetIndexFile( indexName );
+  }
+
+  return reader;
+}
+
+
+
+static int Pack( ZippedToolOptions& options ) {
+  ZIPASSERT( options.Output != Null, "The output file is not specified." );
+  ZIPASSERT( strcmp( options.Codec, "deflate" ) == 0 || strcmp( options.Codec, "zlib" ) == 0, "Unknown codec. Only deflate is supported." );
+  // The standard output may be a pipe, the stream is written forward only
+  bool streaming = strcmp( options.Output, "-" ) == 0;
+  FILE* file = Null;
+  if( streaming ) {
+    _setmode( _fileno( stdout ), _O_BINARY );
+    file = stdout;
+  }
+  else
+    file = fopen( options.Output, "wb+" );
+
+  ZIPASSERT( file != Null, "Can not open the output file." );
+
+  ZippedStreamWriter* writer = new ZippedStreamWriter( file );
+  writer->SetStreaming( streaming );
+  writer->SetBlockSize( options.BlockSize );
+  writer->SetLevel( options.Level );
+  writer->SetChecksums( options.Checksums );
+  writer->SetRecovery( options.Recovery );
+  writer->SetBlockAlignment( options.Alignment );
 
-  const uint cacheSize = 8192;
-  byte cache[cacheSize];
   uint timeStart = GetTickCount();
-  while( true ) {
-    uint readed = fread( cache, 1, cacheSize, fileIn );
-    if( readed == 0 )
-      break;
+  ulong length = writer->CompressFile( options.Input );
+  writer->Flush();
+  ulong streamSize = writer->GetStreamSize();
+  uint timeEnd = GetTickCount();
+  writer->Close( !streaming );
+
+  PrintThroughput( "Packed", length, timeEnd - timeStart );
+  fprintf( stderr, "Stream size %lu bytes, ratio %.3f\n", streamSize, length ? (double)streamSize / length : 0.0 );
+  return 0;
+}
 
-    if( DebugWriteFiles )
-      writer->Write( cache, readed );
+static int Unpack( ZippedToolOptions& options ) {
+  ZIPASSERT( options.Output != Null, "The output file is not specified." );
+  ZippedStreamReader* reader = OpenReader( options );
+  HANDLE file = CreateFile( options.Output, GENERIC_WRITE, 0, Null, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, Null );
+  if( file == INVALID_HANDLE_VALUE ) {
+    reader->Close();
+    ZIPASSERT( false, "Can not open the output file." );
   }
+
+  uint timeStart = GetTickCount();
+  ulong length = reader->ExtractTo( file );
   uint timeEnd = GetTickCount();
-  cout << "Compressed in " << timeEnd - timeStart << "ms" << endl;
+  CloseHandle( file );
+  reader->Close();
 
-  writer->Close();
-  fclose( fileIn );
+  PrintThroughput( "Unpacked", length, timeEnd - timeStart );
+  return 0;
 }
 
+static int Cat( ZippedToolOptions& options ) {
+  ZippedStreamReader* reader = OpenReader( options );
+  _setmode( _fileno( stdout ), _O_BINARY );
+
+  const uint cacheSize = 1024 * 64;
+  byte* cache = new byte[cacheSize];
+  ulong length = 0;
+  uint timeStart = GetTickCount();
+  reader->Seek( min( options.Offset, reader->GetLength() ) );
+  while( length < options.Length ) {
+    ulong readed = reader->Read( cache, min( (ulong)cacheSize, options.Length - length ) );
+    if( readed == 0 )
+      break;
 
+    fwrite( cache, 1, readed, stdout );
+    length += readed;
+  }
+  fflush( stdout );
+  uint timeEnd = GetTickCount();
+
+  delete[] cache;
+  reader->Close();
+  PrintThroughput( "Read", length, timeEnd - timeStart );
+  return 0;
+}
 
-void TestDecompress() {
-  cout << "Decompressed test . . ." << endl;
-  char* fileName = "unzipped.vdf";
-  FILE* fileOut = fopen( fileName, "wb+" );
-  if( fileOut == Null ) {
-    throw std::exception( "Can not open Output file." );
-    return;
+static int Decode( ZippedToolOptions& options ) {
+  // The input may be a pipe, the blocks are read in order
+  bool piped = strcmp( options.Input, "-" ) == 0;
+  FILE* file = Null;
+  if( piped ) {
+    _setmode( _fileno( stdin ), _O_BINARY );
+    file = stdin;
   }
+  else
+    file = fopen( options.Input, "rb" );
 
-  ZippedStreamReader* reader = new ZippedStreamReader( fopen( "zipped.vdf", "rb" ) );
+  ZIPASSERT( file != Null, "Can not open the input file." );
+  ZippedSequentialReader* reader = new ZippedSequentialReader( file );
+  _setmode( _fileno( stdout ), _O_BINARY );
 
-  const uint cacheSize = 8192;
-  byte cache[cacheSize];
+  // The checksums of the stream are checked while decoding
+  if( reader->GetFlags() & ZIPPED_STREAM_CHECKSUM )
+    reader->SetVerification( true );
+
+  const uint cacheSize = 1024 * 64;
+  byte* cache = new byte[cacheSize];
+  ulong length = 0;
   uint timeStart = GetTickCount();
   while( true ) {
-    uint readed = reader->Read( cache, cacheSize );
+    ulong readed = reader->Read( cache, cacheSize );
     if( readed == 0 )
       break;
 
-    if( DebugWriteFiles )
-      fwrite( cache, 1, readed, fileOut );
+    fwrite( cache, 1, readed, stdout );
+    length += readed;
   }
+  fflush( stdout );
   uint timeEnd = GetTickCount();
-  cout << "Decompressed in " << timeEnd - timeStart << "ms" << endl;
 
+  delete[] cache;
+  reader->Close( !piped );
+  PrintThroughput( "Decoded", length, timeEnd - timeStart );
+  return 0;
+}
+
+static int Verify( ZippedToolOptions& options ) {
+  ZippedStreamReader* reader = OpenReader( options );
+  ulong length = reader->GetLength();
+
+  uint timeStart = GetTickCount();
+  bool valid = reader->Verify();
+  uint timeEnd = GetTickCount();
   reader->Close();
-  fclose( fileOut );
+
+  PrintThroughput( "Verified", length, timeEnd - timeStart );
+  fprintf( stderr, valid ? "Stream is valid\n" : "Stream is corrupted\n" );
+  return valid ? 0 : 2;
 }
 
+static int Stat( ZippedToolOptions& options ) {
+  uint timeStart = GetTickCount();
+  ZippedStreamReader* reader = OpenReader( options );
+  uint timeEnd = GetTickCount();
 
+  ulong flags = reader->GetFlags();
+  uint blocksCount = reader->GetBlocksCount();
+  printf( "Length        %lu\n", reader->GetLength() );
+  printf( "Stream size   %lu\n", reader->GetStreamSize() );
+  printf( "Block size    %lu%s\n", reader->GetBlockSize(), reader->IsChunked() ? " (chunked)" : "" );
+  printf( "Blocks        %u\n", blocksCount );
+  printf( "Header size   %lu\n", reader->GetHeaderSize() );
+  printf( "Flags        %s%s%s%s%s%s%s%s%s%s\n",
+    flags == 0 ? " none" : "",
+    flags & ZIPPED_STREAM_DICTIONARY    ? " dictionary"    : "",
+    flags & ZIPPED_STREAM_DEDUPLICATION ? " deduplication" : "",
+    flags & ZIPPED_STREAM_CHUNKED       ? " chunked"       : "",
+    flags & ZIPPED_STREAM_FILL          ? " fill"          : "",
+    flags & ZIPPED_STREAM_FILTER        ? " filter"        : "",
+    flags & ZIPPED_STREAM_CHECKSUM      ? " checksum"      : "",
+    flags & ZIPPED_STREAM_ALIGNED       ? " aligned"       : "",
+    flags & ZIPPED_STREAM_RECOVERY      ? " recovery"      : "",
+    flags & ZIPPED_STREAM_TRAILER       ? " trailer"       : "" );
 
+  printf( "\n%8s %12s %12s %10s %10s %7s  %s\n", "Block", "Position", "File offset", "Source", "Stored", "Ratio", "Kind" );
+  ulong referencesCount = 0;
+  ulong fillsCount = 0;
+  ulong storedSize = 0;
+  for( uint i = 0; i < blocksCount; i++ ) {
+    ZippedBlockInfo info;
+    reader->GetBlockInfo( i, info );
+    storedSize += info.LengthCompressed;
 
-void TestCopy() {
-  cout << "Copy test . . ." << endl;
-  char* fileName1 = "Textures.vdf";
-  FILE* fileIn = fopen( fileName1, "rb" );
-  if( fileIn == Null ) {
-    throw std::exception( "Can not open Input file." );
-    return;
-  }
+    char kind[32] = "data";
+    if( info.Flags & ZIPPED_BLOCK_REFERENCE ) {
+      sprintf( kind, "ref %lu", info.Reference );
+      referencesCount++;
+    }
+    else if( info.Flags & ZIPPED_BLOCK_FILL ) {
+      sprintf( kind, "fill 0x%02lX", info.Reference );
+      fillsCount++;
+    }
 
-  char* fileName2 = "copied.vdf";
-  FILE* fileOut = fopen( fileName2, "wb+" );
-  if( fileOut == Null ) {
-    throw std::exception( "Can not open Output file." );
-    return;
+    double ratio = info.LengthSource ? (double)info.FileSize / info.LengthSource : 0.0;
+    printf( "%8u %12lu %12lu %10lu %10lu %7.3f  %s\n", i, info.Position, info.FilePosition, info.LengthSource, info.FileSize, ratio, kind );
   }
 
-  const uint cacheSize = 8192;
-  byte cache[cacheSize];
-  uint timeStart = GetTickCount();
-  while( true ) {
-    uint readed = fread( cache, 1, cacheSize, fileIn );
-    if( readed == 0 )
-      break;
+  ulong length = reader->GetLength();
+  printf( "\nData blocks %lu, references %lu, fills %lu\n", blocksCount - referencesCount - fillsCount, referencesCount, fillsCount );
+  printf( "Compressed data %lu bytes, ratio %.3f\n", storedSize, length ? (double)storedSize / length : 0.0 );
+  reader->Close();
+
+  PrintThroughput( "Indexed", length, timeEnd - timeStart );
+  return 0;
+}
+
 
-    if( DebugWriteFiles )
-      fwrite( cache, 1, readed, fileOut );
+
+static int Recover( ZippedToolOptions& options ) {
+  FILE* file = fopen( options.Input, "rb+" );
+  ZIPASSERT( file != Null, "Can not open the input file." );
+  ZippedStreamReader* reader = new ZippedStreamReader( file );
+  if( !(reader->GetFlags() & ZIPPED_STREAM_RECOVERY) ) {
+    // Only a stream written with the recovery has intact blocks after its header
+    reader->Close();
+    fprintf( stderr, "The stream has no recovery data, nothing to recover\n" );
+    return 0;
   }
+
+  ulong length = reader->GetLength();
+  uint blocksCount = reader->GetBlocksCount();
+  reader->Close( false );
+
+  // The append loads the intact blocks and rewrites the header
+  uint timeStart = GetTickCount();
+  ZippedStreamWriter* writer = new ZippedStreamWriter( file );
+  writer->Append();
+  ulong recoveredLength = writer->GetLength();
+  uint recoveredCount = writer->GetBlocksCount();
+  writer->Close();
   uint timeEnd = GetTickCount();
-  cout << "Copy in " << timeEnd - timeStart << "ms" << endl;
 
-  fclose( fileIn );
-  fclose( fileOut );
+  fprintf( stderr, "Header had %u blocks, %lu bytes\n", blocksCount, length );
+  fprintf( stderr, "Recovered %u blocks, %lu bytes\n", recoveredCount, recoveredLength );
+  PrintThroughput( "Recovered", recoveredLength, timeEnd - timeStart );
+  return 0;
 }
 
 
-void main() {
+
+int main( int argc, char** argv ) {
+  ZippedToolOptions options;
+  if( argc < 2 || !ParseOptions( argc, argv, options ) ) {
+    PrintUsage();
+    return 1;
+  }
+
+  PARALLEL_THREADS_COUNT = options.Threads;
   try {
-    while( true ) {
-      for( uint i = 0; i < 5000; i++ ) {
-        cout << "Iteration: " << i << endl;
-        TestDecompress();
-      }
-      //ZippedBlockReaderCache::GetInstance()->ShowDebug();
-      //TestCopy();
-      system( "pause" );
-    }
+    const char* command = argv[1];
+    if( strcmp( command, "pack" ) == 0 )   return Pack( options );
+    if( strcmp( command, "unpack" ) == 0 ) return Unpack( options );
+    if( strcmp( command, "cat" ) == 0 )    return Cat( options );
+    if( strcmp( command, "decode" ) == 0 ) return Decode( options );
+    if( strcmp( command, "verify" ) == 0 ) return Verify( options );
+    if( strcmp( command, "stat" ) == 0 )   return Stat( options );
+    if( strcmp( command, "recover" ) == 0 ) return Recover( options );
   }
   catch( const std::exception& e ) {
-    cout << e.what() << endl;
+    fprintf( stderr, "zstream: %s\n", e.what() );
+    return 2;
   }
 
-  system("pause");
-}
\ No newline at end of file
+  PrintUsage();
+  return 1;
+}